@@ -0,0 +1,511 @@
+#include "fake_servers.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <thread>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+#include "util.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+bool write_all(int fd, const std::string& data) {
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t w = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (w <= 0) return false;
+        sent += static_cast<std::size_t>(w);
+    }
+    return true;
+}
+
+bool fill(int fd, std::string& buf) {
+    char tmp[4096];
+    ssize_t n = ::recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0) return false;
+    buf.append(tmp, static_cast<std::size_t>(n));
+    return true;
+}
+
+std::string url_decode(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out.push_back(' ');
+        } else if (s[i] == '%' && i + 2 < s.size()) {
+            out.push_back(static_cast<char>(std::stoi(std::string(s.substr(i + 1, 2)), nullptr, 16)));
+            i += 2;
+        } else {
+            out.push_back(s[i]);
+        }
+    }
+    return out;
+}
+
+std::string lower(std::string s) {
+    for (auto& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return s;
+}
+
+std::vector<std::string> path_segments(const std::string& path) {
+    std::vector<std::string> out;
+    FieldSplitter sp(path, '/');
+    std::string_view seg;
+    while (sp.next(seg)) {
+        if (!seg.empty()) out.emplace_back(seg);
+    }
+    return out;
+}
+
+int to_int(const std::string& s) {
+    int v = 0;
+    return parse_int(s, &v) ? v : -1;
+}
+
+HttpReply json_reply(int status, const json& j) { return HttpReply{status, j.dump()}; }
+
+std::string resp_bulk(const std::string& s) { return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n"; }
+
+std::string resp_int(long long v) { return ":" + std::to_string(v) + "\r\n"; }
+
+// AnswerLog's kForgetIfEmpty, the only script the fake runs.
+const char* const kForgetIfEmpty =
+    "if redis.call('LLEN', KEYS[1]) == 0 then return redis.call('SREM', KEYS[2], ARGV[1]) end return 0";
+
+// [start, stop] as LRANGE/LTRIM take them, clamped to a list of `size`; empty
+// if first > last.
+std::pair<long long, long long> list_range(const std::string& start, const std::string& stop, std::size_t size) {
+    const auto n = static_cast<long long>(size);
+    long long first = std::stoll(start);
+    long long last = std::stoll(stop);
+    if (first < 0) first += n;
+    if (last < 0) last += n;
+    return {std::max(first, 0LL), std::min(last, n - 1)};
+}
+
+const char* reason(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 304: return "Not Modified";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        default: return "Status";
+    }
+}
+
+} // namespace
+
+int serve_local(std::function<void(int fd)> on_conn) {
+    int lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) return -1;
+    int one = 1;
+    ::setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(lfd, 512) != 0 ||
+        ::getsockname(lfd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        ::close(lfd);
+        return -1;
+    }
+
+    std::thread([lfd, on_conn = std::move(on_conn)]() {
+        while (true) {
+            int fd = ::accept(lfd, nullptr, nullptr);
+            if (fd < 0) continue;
+            std::thread([fd, &on_conn]() { on_conn(fd); }).detach();
+        }
+    }).detach();
+    return ntohs(addr.sin_port);
+}
+
+std::string HttpRequest::param(const std::string& key) const {
+    FieldSplitter sp(query, '&');
+    std::string_view kv;
+    while (sp.next(kv)) {
+        auto eq = kv.find('=');
+        if (url_decode(kv.substr(0, eq)) == key) return eq == std::string_view::npos ? "" : url_decode(kv.substr(eq + 1));
+    }
+    return {};
+}
+
+FakeHttpServer::FakeHttpServer(Handler handler) : handler_(std::move(handler)) {}
+
+bool FakeHttpServer::start() {
+    port_ = serve_local([this](int fd) { serve_connection(fd); });
+    return port_ > 0;
+}
+
+void FakeHttpServer::serve_connection(int fd) {
+    std::string buf;
+    while (true) {
+        std::size_t hdr_end;
+        while ((hdr_end = buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill(fd, buf)) {
+                ::close(fd);
+                return;
+            }
+        }
+
+        HttpRequest req;
+        std::string_view head(buf.data(), hdr_end);
+        FieldSplitter lines(head, '\n');
+        std::string_view line;
+        lines.next(line);
+        auto words = split_ws_view<3>(line);
+        req.method = std::string(words[0]);
+        std::string target(words[1]);
+        auto q = target.find('?');
+        req.path = target.substr(0, q);
+        if (q != std::string::npos) req.query = target.substr(q + 1);
+        while (lines.next(line)) {
+            auto colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            req.headers[lower(std::string(trim_view(line.substr(0, colon))))] = std::string(trim_view(line.substr(colon + 1)));
+        }
+
+        std::size_t body_len = 0;
+        auto cl = req.headers.find("content-length");
+        if (cl != req.headers.end()) body_len = static_cast<std::size_t>(std::stoul(cl->second));
+        while (buf.size() < hdr_end + 4 + body_len) {
+            if (!fill(fd, buf)) {
+                ::close(fd);
+                return;
+            }
+        }
+        req.body = buf.substr(hdr_end + 4, body_len);
+        buf.erase(0, hdr_end + 4 + body_len);
+
+        HttpReply reply = handler_(req);
+        // GETs carry a body-hash ETag and honour If-None-Match like the real backend.
+        std::string etag;
+        if (req.method == "GET" && reply.status == 200) {
+            etag = "\"" + std::to_string(std::hash<std::string>{}(reply.body)) + "\"";
+            if (req.headers["if-none-match"] == etag) reply = HttpReply{304, ""};
+        }
+        std::string out = "HTTP/1.1 " + std::to_string(reply.status) + " " + reason(reply.status) + "\r\n" +
+                          "Content-Type: application/json\r\n" +
+                          (etag.empty() ? std::string{} : "ETag: " + etag + "\r\n") +
+                          "Content-Length: " + std::to_string(reply.body.size()) + "\r\n\r\n" + reply.body;
+        if (!write_all(fd, out) || lower(req.headers["connection"]) == "close") break;
+    }
+    ::close(fd);
+}
+
+FakeBackend::FakeBackend(Options opts) : opts_(opts) {}
+
+HttpReply FakeBackend::handle(const HttpRequest& req) {
+    if (opts_.latency_us > 0) std::this_thread::sleep_for(std::chrono::microseconds(opts_.latency_us));
+
+    const auto seg = path_segments(req.path);
+    const auto& m = req.method;
+    auto at = [&](std::size_t i) -> const std::string& {
+        static const std::string empty;
+        return i < seg.size() ? seg[i] : empty;
+    };
+
+    // --- auth service ---
+    if (at(0) == "auth") {
+        const std::string tok = req.param("token_in");
+        if (at(1) == "login") return json_reply(200, {{"url", "https://auth.local/login/" + tok}});
+        if (at(1) == "check") {
+            return json_reply(200,
+                              {{"status", "доступ предоставлен"},
+                               {"access_token", "acc-" + tok},
+                               {"refresh_token", "ref-" + tok}});
+        }
+        if (at(1) == "refresh") return json_reply(200, {{"access_token", "acc-r"}, {"refresh_token", "ref-r"}});
+        if (at(1) == "logout") return json_reply(200, json::object());
+        return json_reply(404, {{"detail", "not found"}});
+    }
+
+    if (at(0) == "notification") return json_reply(200, m == "GET" ? json::array() : json::object());
+    if (at(0) != "api") return json_reply(404, {{"detail", "not found"}});
+
+    // --- main backend ---
+    if (at(1) == "users") {
+        if (at(2) == "me") return json_reply(200, {{"id", 1}, {"username", "bench"}, {"role", "admin"}});
+        if (seg.size() == 2) {
+            // limit/offset paging as the real backend is expected to implement it.
+            const int offset = req.param("offset").empty() ? 0 : to_int(req.param("offset"));
+            const int limit = req.param("limit").empty() ? opts_.users : to_int(req.param("limit"));
+            json users = json::array();
+            for (int i = offset + 1; i <= std::min(opts_.users, offset + limit); ++i) {
+                users.push_back({{"id", i}, {"username", "user" + std::to_string(i)}, {"full_name", "User " + std::to_string(i)}, {"is_blocked", false}});
+            }
+            return json_reply(200, users);
+        }
+        if (at(3) == "data") {
+            return json_reply(200, {{"id", to_int(at(2))}, {"username", "bench"}, {"full_name", "Bench User"}, {"email", "bench@local"}, {"is_blocked", false}, {"courses_count", opts_.courses}, {"attempts_count", 0}});
+        }
+        return json_reply(200, json::object());
+    }
+
+    if (at(1) == "courses") {
+        if (seg.size() == 2) {
+            if (m == "POST") return json_reply(201, {{"id", opts_.courses + 1}, {"title", req.param("title")}});
+            json courses = json::array();
+            for (int i = 1; i <= opts_.courses; ++i) courses.push_back({{"id", i}, {"title", "Course " + std::to_string(i)}});
+            return json_reply(200, courses);
+        }
+        if (at(3) == "tests" && seg.size() == 4) {
+            if (m == "POST") return json_reply(201, {{"id", 1}, {"title", "test"}});
+            const int course = to_int(at(2));
+            json tests = json::array();
+            for (int i = 1; i <= opts_.tests_per_course; ++i) {
+                tests.push_back({{"id", course * 100 + i}, {"title", "Test " + std::to_string(i)}, {"is_active", true}});
+            }
+            return json_reply(200, tests);
+        }
+        return json_reply(200, json::object());
+    }
+
+    if (at(1) == "attempts") {
+        if (at(2) == "tests" && m == "POST") return json_reply(201, {{"id", next_attempt_++}});
+        if (at(3) == "finish") return json_reply(200, {{"id", to_int(at(2))}, {"score", 1.0}});
+        return json_reply(404, {{"detail", "not found"}});
+    }
+
+    if (at(1) == "answers") {
+        if (at(2) == "attempts") {
+            const int attempt = to_int(at(3));
+            json answers = json::array();
+            for (int i = 0; i < opts_.questions_per_attempt; ++i) {
+                answers.push_back({{"id", attempt * 1000 + i}, {"question_id", i + 1}, {"value", nullptr}});
+            }
+            return json_reply(200, answers);
+        }
+        if (m == "PATCH") return json_reply(200, {{"id", to_int(at(2))}});
+        return json_reply(404, {{"detail", "not found"}});
+    }
+
+    if (at(1) == "questions") {
+        if (m == "POST") return json_reply(201, {{"id", 1}});
+        json opts = json::array();
+        for (int i = 0; i < opts_.options_per_question; ++i) opts.push_back("Option " + std::to_string(i + 1));
+        return json_reply(200, {{"id", to_int(at(2))}, {"title", "Question " + at(2)}, {"text", "What is the answer?"}, {"options", opts}});
+    }
+
+    return json_reply(404, {{"detail", "not found"}});
+}
+
+bool FakeRedisServer::start() {
+    port_ = serve_local([this](int fd) { serve_connection(fd); });
+    return port_ > 0;
+}
+
+void FakeRedisServer::serve_connection(int fd) {
+    std::string buf;
+    std::size_t pos = 0;
+
+    auto read_line = [&](std::string& line) -> bool {
+        std::size_t e;
+        while ((e = buf.find("\r\n", pos)) == std::string::npos) {
+            if (!fill(fd, buf)) return false;
+        }
+        line = buf.substr(pos, e - pos);
+        pos = e + 2;
+        return true;
+    };
+
+    while (true) {
+        std::string line;
+        if (!read_line(line) || line.empty() || line[0] != '*') break;
+        const long n = std::stol(line.substr(1));
+        std::vector<std::string> args;
+        bool ok = true;
+        for (long i = 0; i < n && ok; ++i) {
+            if (!read_line(line) || line.empty() || line[0] != '$') {
+                ok = false;
+                break;
+            }
+            const auto len = static_cast<std::size_t>(std::stol(line.substr(1)));
+            while (buf.size() < pos + len + 2) {
+                if (!fill(fd, buf)) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (!ok) break;
+            args.push_back(buf.substr(pos, len));
+            pos += len + 2;
+        }
+        if (!ok || !write_all(fd, execute(args))) break;
+        buf.erase(0, pos);
+        pos = 0;
+    }
+    ::close(fd);
+}
+
+std::string FakeRedisServer::execute(const std::vector<std::string>& args) {
+    if (args.empty()) return "-ERR empty command\r\n";
+    std::string cmd = args[0];
+    for (auto& c : cmd) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (cmd == "PING") return "+PONG\r\n";
+    if (cmd == "GET" && args.size() == 2) {
+        auto it = strings_.find(args[1]);
+        return it == strings_.end() ? "$-1\r\n" : resp_bulk(it->second);
+    }
+    if (cmd == "SET" && args.size() >= 3) {
+        strings_[args[1]] = args[2];
+        return "+OK\r\n";
+    }
+    if (cmd == "DEL" && args.size() >= 2) {
+        long long n = 0;
+        for (std::size_t i = 1; i < args.size(); ++i) {
+            n += static_cast<long long>(strings_.erase(args[i]) + sets_.erase(args[i]) + lists_.erase(args[i]));
+        }
+        return resp_int(n);
+    }
+    if (cmd == "SADD" && args.size() >= 3) {
+        long long n = 0;
+        for (std::size_t i = 2; i < args.size(); ++i) n += sets_[args[1]].insert(args[i]).second ? 1 : 0;
+        return resp_int(n);
+    }
+    if (cmd == "SREM" && args.size() >= 3) {
+        long long n = 0;
+        auto it = sets_.find(args[1]);
+        if (it != sets_.end()) {
+            for (std::size_t i = 2; i < args.size(); ++i) n += static_cast<long long>(it->second.erase(args[i]));
+        }
+        return resp_int(n);
+    }
+    if (cmd == "SMEMBERS" && args.size() == 2) {
+        auto it = sets_.find(args[1]);
+        if (it == sets_.end()) return "*0\r\n";
+        std::string out = "*" + std::to_string(it->second.size()) + "\r\n";
+        for (const auto& m : it->second) out += resp_bulk(m);
+        return out;
+    }
+    if (cmd == "SSCAN" && args.size() >= 3) {
+        // The whole set in one step.
+        auto it = sets_.find(args[1]);
+        std::string out = "*2\r\n" + resp_bulk("0");
+        if (it == sets_.end()) return out + "*0\r\n";
+        out += "*" + std::to_string(it->second.size()) + "\r\n";
+        for (const auto& m : it->second) out += resp_bulk(m);
+        return out;
+    }
+    if (cmd == "MGET" && args.size() >= 2) {
+        std::string out = "*" + std::to_string(args.size() - 1) + "\r\n";
+        for (std::size_t i = 1; i < args.size(); ++i) {
+            auto it = strings_.find(args[i]);
+            out += it == strings_.end() ? "$-1\r\n" : resp_bulk(it->second);
+        }
+        return out;
+    }
+    if (cmd == "RPUSH" && args.size() >= 3) {
+        auto& l = lists_[args[1]];
+        l.insert(l.end(), args.begin() + 2, args.end());
+        return resp_int(static_cast<long long>(l.size()));
+    }
+    if (cmd == "LLEN" && args.size() == 2) {
+        auto it = lists_.find(args[1]);
+        return resp_int(it == lists_.end() ? 0 : static_cast<long long>(it->second.size()));
+    }
+    if (cmd == "LRANGE" && args.size() == 4) {
+        auto it = lists_.find(args[1]);
+        if (it == lists_.end()) return "*0\r\n";
+        const auto [first, last] = list_range(args[2], args[3], it->second.size());
+        if (first > last) return "*0\r\n";
+        std::string out = "*" + std::to_string(last - first + 1) + "\r\n";
+        for (long long i = first; i <= last; ++i) out += resp_bulk(it->second[static_cast<std::size_t>(i)]);
+        return out;
+    }
+    if (cmd == "LTRIM" && args.size() == 4) {
+        auto it = lists_.find(args[1]);
+        if (it == lists_.end()) return "+OK\r\n";
+        const auto [first, last] = list_range(args[2], args[3], it->second.size());
+        if (first > last) {
+            lists_.erase(it);
+            return "+OK\r\n";
+        }
+        auto& l = it->second;
+        l.erase(l.begin() + last + 1, l.end());
+        l.erase(l.begin(), l.begin() + first);
+        return "+OK\r\n";
+    }
+    if (cmd == "EXPIRE" && args.size() >= 3) {
+        const bool exists = strings_.count(args[1]) || sets_.count(args[1]) || lists_.count(args[1]);
+        return resp_int(exists ? 1 : 0);
+    }
+    if (cmd == "EVAL" && args.size() == 6 && args[1] == kForgetIfEmpty && args[2] == "2") {
+        auto l = lists_.find(args[3]);
+        if (l != lists_.end() && !l->second.empty()) return resp_int(0);
+        auto s = sets_.find(args[4]);
+        return resp_int(s == sets_.end() ? 0 : static_cast<long long>(s->second.erase(args[5])));
+    }
+    return "-ERR unknown command '" + args[0] + "'\r\n";
+}
+
+std::string FakeTelegram::makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const {
+    const auto slash = url.path.rfind('/');
+    const std::string method = slash == std::string::npos ? url.path : url.path.substr(slash + 1);
+
+    std::unordered_map<std::string, std::string> a;
+    for (const auto& arg : args) a[arg.name] = arg.value;
+
+    if (method == "sendMessage" || method == "editMessageText" || method == "editMessageReplyMarkup") {
+        const std::int64_t chatId = a.count("chat_id") ? std::stoll(a["chat_id"]) : 0;
+        if (method == "sendMessage") sent_++;
+
+        auto markup = a.find("reply_markup");
+        std::vector<std::string> datas;
+        if (markup != a.end()) {
+            try {
+                auto kb = json::parse(markup->second);
+                for (auto& row : kb.value("inline_keyboard", json::array())) {
+                    for (auto& b : row) datas.push_back(b.value("callback_data", ""));
+                }
+            } catch (...) {
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            replies_[chatId]++;
+            if (markup != a.end()) buttons_[chatId] = std::move(datas);
+        }
+
+        std::int32_t messageId = next_message_id_++;
+        if (a.count("message_id")) messageId = static_cast<std::int32_t>(std::stol(a["message_id"]));
+        json msg{{"message_id", messageId},
+                 {"date", 0},
+                 {"chat", {{"id", chatId}, {"type", "private"}}},
+                 {"text", a.count("text") ? a["text"] : ""}};
+        return json{{"ok", true}, {"result", msg}}.dump();
+    }
+    if (method == "getUpdates") return R"({"ok":true,"result":[]})";
+    if (method == "getMe") {
+        return R"({"ok":true,"result":{"id":1,"is_bot":true,"first_name":"bench","username":"bench_bot"}})";
+    }
+    return R"({"ok":true,"result":true})";
+}
+
+std::vector<std::string> FakeTelegram::last_buttons(std::int64_t chatId) const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = buttons_.find(chatId);
+    return it == buttons_.end() ? std::vector<std::string>{} : it->second;
+}
+
+std::uint64_t FakeTelegram::replies(std::int64_t chatId) const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = replies_.find(chatId);
+    return it == replies_.end() ? 0 : it->second;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tgbot/tgbot.h>
+
+// In-process stand-ins for the Telegram Bot API, the auth/main backends and Redis,
+// so the bot can be driven end-to-end without any network access.
+
+// Binds 127.0.0.1 on an ephemeral port and hands every accepted connection to
+// `on_conn` on its own detached thread. Returns the port, or -1.
+int serve_local(std::function<void(int fd)> on_conn);
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers;
+    std::string body;
+
+    std::string param(const std::string& key) const;
+};
+
+struct HttpReply {
+    int status{200};
+    std::string body;
+};
+
+class FakeHttpServer {
+public:
+    using Handler = std::function<HttpReply(const HttpRequest&)>;
+
+    explicit FakeHttpServer(Handler handler);
+
+    bool start();
+    std::string base_url() const { return "http://127.0.0.1:" + std::to_string(port_); }
+
+private:
+    Handler handler_;
+    int port_{-1};
+
+    void serve_connection(int fd);
+};
+
+// Auth + main backend with deterministic fixtures. Every request sleeps for
+// `latency_us` to emulate a remote service.
+class FakeBackend {
+public:
+    struct Options {
+        int courses{5};
+        int tests_per_course{3};
+        int questions_per_attempt{10};
+        int options_per_question{4};
+        int users{50};
+        int latency_us{0};
+    };
+
+    explicit FakeBackend(Options opts);
+
+    HttpReply handle(const HttpRequest& req);
+
+private:
+    Options opts_;
+    std::atomic<int> next_attempt_{1};
+};
+
+// Minimal RESP server covering what the bench tools make the bot issue:
+// strings, sets, and the batched-answer log's lists and its one script. Keys
+// never expire; streams and other scripts get an error.
+class FakeRedisServer {
+public:
+    bool start();
+    int port() const { return port_; }
+
+private:
+    int port_{-1};
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::string> strings_;
+    std::unordered_map<std::string, std::set<std::string>> sets_;
+    std::unordered_map<std::string, std::deque<std::string>> lists_;
+
+    void serve_connection(int fd);
+    std::string execute(const std::vector<std::string>& args);
+};
+
+// TgBot::HttpClient that answers Bot API calls locally and remembers the last
+// inline keyboard sent to each chat so synthetic users can "tap" it.
+class FakeTelegram : public TgBot::HttpClient {
+public:
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override;
+
+    std::vector<std::string> last_buttons(std::int64_t chatId) const;
+    std::uint64_t sent() const { return sent_.load(); }
+    // Messages sent or edited in this chat so far.
+    std::uint64_t replies(std::int64_t chatId) const;
+
+private:
+    mutable std::mutex mtx_;
+    mutable std::unordered_map<std::int64_t, std::vector<std::string>> buttons_;
+    mutable std::unordered_map<std::int64_t, std::uint64_t> replies_;
+    mutable std::atomic<std::uint64_t> sent_{0};
+    mutable std::atomic<std::int32_t> next_message_id_{1};
+};
@@ -0,0 +1,258 @@
+// Offline load test: drives TelegramModuleBot through login -> courses -> quiz flows
+// against in-process fakes of the Bot API, the auth/main backends and Redis, then
+// reports throughput and per-handler latency percentiles.
+//
+//   tg_bench [--users N] [--threads N] [--questions N] [--backend-latency-us N]
+//            [--redis host:port]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tgbot/tgbot.h>
+
+#include "auth_client.h"
+#include "callback_data.h"
+#include "fake_servers.h"
+#include "main_client.h"
+#include "metrics.h"
+#include "redis_client.h"
+#include "session_store.h"
+#include "telegram_bot.h"
+
+namespace {
+
+struct Options {
+    int users{200};
+    int threads{8};
+    int questions{10};
+    int backend_latency_us{0};
+    std::string redis;
+};
+
+Options parse_args(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string k = argv[i];
+        const std::string v = argv[i + 1];
+        if (k == "--users") o.users = std::stoi(v);
+        else if (k == "--threads") o.threads = std::stoi(v);
+        else if (k == "--questions") o.questions = std::stoi(v);
+        else if (k == "--backend-latency-us") o.backend_latency_us = std::stoi(v);
+        else if (k == "--redis") o.redis = v;
+        else std::cerr << "ignoring unknown option " << k << std::endl;
+    }
+    return o;
+}
+
+const char* step_name(CallbackAction a) {
+    switch (a) {
+        case CallbackAction::COURSE: return "cb_course";
+        case CallbackAction::TEST: return "cb_test";
+        case CallbackAction::ANSWER: return "cb_answer";
+        case CallbackAction::FINISH: return "cb_finish";
+        case CallbackAction::BACK_COURSES: return "cb_back_courses";
+        case CallbackAction::USERS_PAGE: return "cb_users_page";
+        case CallbackAction::NONE: break;
+    }
+    return "cb_invalid";
+}
+
+class Driver {
+public:
+    Driver(TelegramModuleBot& bot, const FakeTelegram& tg) : bot_(bot), tg_(tg) {}
+
+    void command(std::int64_t chatId, const std::string& text) {
+        auto u = std::make_shared<TgBot::Update>();
+        u->updateId = next_update_++;
+        u->message = make_message(chatId);
+        u->message->text = text;
+        const auto space = text.find(' ');
+        timed(text.substr(1, space == std::string::npos ? std::string::npos : space - 1), u);
+    }
+
+    // Taps the button at `idx` on the last keyboard the bot sent to this chat.
+    // A tap the bot answers with neither a new nor an edited message counts as
+    // a failed step (an unrouted callback, say) and ends the flow.
+    bool tap(std::int64_t chatId, std::size_t idx) {
+        auto buttons = tg_.last_buttons(chatId);
+        if (buttons.empty()) return false;
+        const std::string data = buttons[std::min(idx, buttons.size() - 1)];
+
+        auto u = std::make_shared<TgBot::Update>();
+        u->updateId = next_update_++;
+        u->callbackQuery = std::make_shared<TgBot::CallbackQuery>();
+        u->callbackQuery->id = std::to_string(u->updateId);
+        u->callbackQuery->data = data;
+        u->callbackQuery->message = make_message(chatId);
+
+        CallbackData d;
+        decode_callback(data, &d);
+        const std::uint64_t before = tg_.replies(chatId);
+        timed(step_name(d.action), u);
+        if (tg_.replies(chatId) != before) return true;
+        failed(step_name(d.action));
+        return false;
+    }
+
+    std::uint64_t failures() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::uint64_t n = 0;
+        for (const auto& [name, f] : failed_) n += f;
+        return n;
+    }
+
+    bool last_keyboard_is_finish(std::int64_t chatId) const {
+        auto buttons = tg_.last_buttons(chatId);
+        CallbackData d;
+        return buttons.size() == 1 && decode_callback(buttons[0], &d) && d.action == CallbackAction::FINISH;
+    }
+
+    void report(double wall_seconds) const {
+        std::uint64_t total = 0;
+        for (const auto& [name, h] : steps_) total += h->count();
+        std::printf("updates: %llu in %.2fs -> %.1f updates/s, %llu messages sent\n",
+                    static_cast<unsigned long long>(total),
+                    wall_seconds,
+                    static_cast<double>(total) / wall_seconds,
+                    static_cast<unsigned long long>(tg_.sent()));
+        std::printf("%-18s %10s %10s %10s %10s %10s\n", "handler", "count", "failed", "p50_ms", "p99_ms", "mean_ms");
+        for (const auto& [name, h] : steps_) {
+            const auto n = h->count();
+            if (n == 0) continue;
+            const auto f = failed_.find(name);
+            std::printf("%-18s %10llu %10llu %10.3f %10.3f %10.3f\n",
+                        name.c_str(),
+                        static_cast<unsigned long long>(n),
+                        static_cast<unsigned long long>(f == failed_.end() ? 0 : f->second),
+                        static_cast<double>(h->quantile_us(0.50)) / 1e3,
+                        static_cast<double>(h->quantile_us(0.99)) / 1e3,
+                        static_cast<double>(h->sum_us()) / 1e3 / static_cast<double>(n));
+        }
+    }
+
+private:
+    TelegramModuleBot& bot_;
+    const FakeTelegram& tg_;
+    std::atomic<std::int32_t> next_update_{1};
+    mutable std::mutex mtx_;
+    std::map<std::string, std::unique_ptr<Histogram>> steps_;
+    std::map<std::string, std::uint64_t> failed_;
+
+    static TgBot::Message::Ptr make_message(std::int64_t chatId) {
+        auto m = std::make_shared<TgBot::Message>();
+        m->chat = std::make_shared<TgBot::Chat>();
+        m->chat->id = chatId;
+        return m;
+    }
+
+    Histogram& step(const std::string& name) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto& h = steps_[name];
+        if (!h) h = std::make_unique<Histogram>();
+        return *h;
+    }
+
+    void failed(const std::string& name) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        failed_[name]++;
+    }
+
+    void timed(const std::string& name, const TgBot::Update::Ptr& u) {
+        Histogram& h = step(name);
+        ScopedTimer timer(h);
+        bot_.process_update(u);
+    }
+};
+
+void run_user(Driver& d, std::int64_t chatId, int max_steps, std::mt19937& rng) {
+    d.command(chatId, "/login github");
+    d.command(chatId, "/courses");
+    if (!d.tap(chatId, 0)) return; // course
+    if (!d.tap(chatId, 0)) return; // test -> attempt + first question
+    for (int i = 0; i < max_steps && !d.last_keyboard_is_finish(chatId); ++i) {
+        if (!d.tap(chatId, rng() % 4)) return;
+    }
+    d.tap(chatId, 0); // finish
+    d.command(chatId, "/me");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Options opt = parse_args(argc, argv);
+    // Simulated users tap as fast as the bot answers; measure the handlers, not the limiter.
+    ::setenv("TG_RATE_LIMIT", "0", 0);
+
+    FakeBackend::Options bo;
+    bo.questions_per_attempt = opt.questions;
+    bo.latency_us = opt.backend_latency_us;
+    FakeBackend backend(bo);
+    FakeHttpServer http([&backend](const HttpRequest& r) { return backend.handle(r); });
+    if (!http.start()) {
+        std::cerr << "failed to start fake backend" << std::endl;
+        return 1;
+    }
+
+    std::string redis_host = "127.0.0.1";
+    int redis_port = 0;
+    FakeRedisServer fake_redis;
+    if (!opt.redis.empty()) {
+        auto colon = opt.redis.rfind(':');
+        redis_host = opt.redis.substr(0, colon);
+        redis_port = std::stoi(opt.redis.substr(colon + 1));
+    } else if (fake_redis.start()) {
+        redis_port = fake_redis.port();
+    } else {
+        std::cerr << "failed to start fake redis" << std::endl;
+        return 1;
+    }
+
+    auto store = std::make_shared<SessionStore>(std::make_shared<RedisClient>(redis_host, redis_port));
+    if (!store->ping()) {
+        std::cerr << "redis not reachable at " << redis_host << ":" << redis_port << std::endl;
+        return 1;
+    }
+
+    FakeTelegram tg;
+    TelegramModuleBot bot("0:bench", store, AuthClient(http.base_url()), MainClient(http.base_url()), tg);
+    Driver driver(bot, tg);
+
+    std::printf("tg_bench: %d users, %d threads, %d questions/attempt, backend latency %dus, redis %s\n",
+                opt.users,
+                opt.threads,
+                opt.questions,
+                opt.backend_latency_us,
+                opt.redis.empty() ? "stub" : opt.redis.c_str());
+
+    std::atomic<int> next_user{0};
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < opt.threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(static_cast<unsigned>(t));
+            for (int u = next_user++; u < opt.users; u = next_user++) {
+                run_user(driver, 1'000'000 + u, opt.questions * 2, rng);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    driver.report(wall);
+    if (driver.failures() > 0) {
+        std::cerr << driver.failures() << " step(s) got no reply from the bot" << std::endl;
+        return 1;
+    }
+    return 0;
+}
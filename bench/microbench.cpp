@@ -0,0 +1,448 @@
+// Micro-benchmarks for the helpers that run on every update. Each benchmark also
+// reports heap allocations per iteration (allocs/iter) via a global operator new hook.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+#include "callback_data.h"
+#include "flight_recorder.h"
+#include "json_stream.h"
+#include "keyboard.h"
+#include "keyboard_cache.h"
+#include "rate_limiter.h"
+#include "redis_client.h"
+#include "session.h"
+#include "update_arena.h"
+#include "util.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+std::atomic<std::uint64_t> g_allocs{0};
+
+} // namespace
+
+void* operator new(std::size_t n) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+struct RedisClientBenchAccess {
+    static std::string encode(const std::vector<std::string>& args) { return RedisClient::encode(args); }
+    static bool parse(int fd) { return RedisClient::parse_resp(fd).has_value(); }
+};
+
+namespace {
+
+class AllocCounter {
+public:
+    // With forbid set, any allocation fails the benchmark instead of being counted.
+    explicit AllocCounter(benchmark::State& state, bool forbid = false)
+        : state_(state), start_(g_allocs.load()), forbid_(forbid) {}
+    ~AllocCounter() {
+        const std::uint64_t n = g_allocs.load() - start_;
+        state_.counters["allocs/iter"] = benchmark::Counter(static_cast<double>(n), benchmark::Counter::kAvgIterations);
+        if (forbid_ && n > 0) state_.SkipWithError("allocated on a path that must not");
+    }
+
+private:
+    benchmark::State& state_;
+    std::uint64_t start_;
+    bool forbid_;
+};
+
+Session sample_session() {
+    Session s;
+    s.status = SessionStatus::AUTH;
+    s.login_type = "github";
+    s.access_token = std::string(180, 'a');
+    s.refresh_token = std::string(64, 'r');
+    s.current_course_id = 12;
+    s.current_test_id = 345;
+    s.current_attempt_id = 6789;
+    s.current_answer_index = 4;
+    return s;
+}
+
+const std::string kQuestionCreate =
+    "/question_create 42 | Capital of France | Which city is the capital of France? | "
+    "Paris; London; Berlin; Madrid | 0";
+
+void BM_SessionToJson(benchmark::State& state) {
+    const Session s = sample_session();
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(session_to_json(s).dump());
+}
+BENCHMARK(BM_SessionToJson);
+
+void BM_SessionFromJson(benchmark::State& state) {
+    const std::string raw = session_to_json(sample_session()).dump();
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(session_from_json(json::parse(raw)));
+}
+BENCHMARK(BM_SessionFromJson);
+
+void BM_RespEncodeSet(benchmark::State& state) {
+    const std::vector<std::string> args = {
+        "SET", "tg:session:123456789", session_to_json(sample_session()).dump(), "EX", "604800"};
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(RedisClientBenchAccess::encode(args));
+}
+BENCHMARK(BM_RespEncodeSet);
+
+// Feeds a canned reply through a socketpair so parse_resp runs its real recv() path.
+void parse_reply(benchmark::State& state, const std::string& reply) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::size_t sent = 0;
+        while (sent < reply.size()) sent += static_cast<std::size_t>(::write(fds[0], reply.data() + sent, reply.size() - sent));
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(RedisClientBenchAccess::parse(fds[1]));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * reply.size()));
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+void BM_RespParseBulk(benchmark::State& state) {
+    const std::string body = session_to_json(sample_session()).dump();
+    parse_reply(state, "$" + std::to_string(body.size()) + "\r\n" + body + "\r\n");
+}
+BENCHMARK(BM_RespParseBulk);
+
+void BM_RespParseSmembers(benchmark::State& state) {
+    std::string reply = "*" + std::to_string(state.range(0)) + "\r\n";
+    for (int i = 0; i < state.range(0); ++i) {
+        const std::string id = std::to_string(100000000 + i);
+        reply += "$" + std::to_string(id.size()) + "\r\n" + id + "\r\n";
+    }
+    parse_reply(state, reply);
+}
+BENCHMARK(BM_RespParseSmembers)->Arg(10)->Arg(1000);
+
+void BM_Trim(benchmark::State& state) {
+    const std::string s = "   Which city is the capital of France?   ";
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(trim(s));
+}
+BENCHMARK(BM_Trim);
+
+void BM_TrimView(benchmark::State& state) {
+    const std::string s = "   Which city is the capital of France?   ";
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(trim_view(s));
+}
+BENCHMARK(BM_TrimView);
+
+void BM_SplitWs(benchmark::State& state) {
+    const std::string s = "/test_delete   12    345";
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(split_ws(s));
+}
+BENCHMARK(BM_SplitWs);
+
+void BM_SplitWsView(benchmark::State& state) {
+    const std::string s = "/test_delete   12    345";
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(split_ws_view<3>(s));
+}
+BENCHMARK(BM_SplitWsView);
+
+void BM_SplitByQuestionCreate(benchmark::State& state) {
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        auto parts = split_by(trim(kQuestionCreate.substr(kQuestionCreate.find(' ') + 1)), '|');
+        auto opts = split_by(trim(parts[3]), ';');
+        for (auto& o : opts) benchmark::DoNotOptimize(trim(o));
+    }
+}
+BENCHMARK(BM_SplitByQuestionCreate);
+
+void BM_SplitByViewQuestionCreate(benchmark::State& state) {
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        auto parts = split_by_view<5>(command_payload(kQuestionCreate), '|');
+        FieldSplitter opts(trim_view(parts[3]), ';');
+        std::string_view o;
+        while (opts.next(o)) benchmark::DoNotOptimize(trim_view(o));
+        int idx = 0;
+        benchmark::DoNotOptimize(parse_int(trim_view(parts[4]), &idx));
+    }
+}
+BENCHMARK(BM_SplitByViewQuestionCreate);
+
+void BM_FindByteLong(benchmark::State& state) {
+    std::string s(static_cast<std::size_t>(state.range(0)), 'x');
+    s.back() = '|';
+    for (auto _ : state) benchmark::DoNotOptimize(find_byte(s, '|'));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * s.size()));
+}
+BENCHMARK(BM_FindByteLong)->Arg(64)->Arg(4096);
+
+void BM_DecodeCallback(benchmark::State& state) {
+    const std::string data = encode_callback(CallbackAction::ANSWER, 123456, 3);
+    AllocCounter ac(state, true);
+    for (auto _ : state) {
+        CallbackData d;
+        benchmark::DoNotOptimize(decode_callback(data, &d));
+        benchmark::DoNotOptimize(d);
+    }
+}
+BENCHMARK(BM_DecodeCallback);
+
+void BM_DecodeCallbackLegacy(benchmark::State& state) {
+    const std::string data = "ans:123456:3";
+    AllocCounter ac(state, true);
+    for (auto _ : state) {
+        CallbackData d;
+        benchmark::DoNotOptimize(decode_callback(data, &d));
+        benchmark::DoNotOptimize(d);
+    }
+}
+BENCHMARK(BM_DecodeCallbackLegacy);
+
+void BM_MakeKb(benchmark::State& state) {
+    std::vector<std::pair<std::string, std::string>> btns;
+    for (int i = 0; i < state.range(0); ++i) {
+        btns.push_back({"Course " + std::to_string(i) + " (#" + std::to_string(i) + ")",
+                        encode_callback(CallbackAction::COURSE, i)});
+    }
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(make_kb(btns));
+}
+BENCHMARK(BM_MakeKb)->Arg(4)->Arg(30);
+
+// The same keyboard served from KeyboardCache, as the course list is after its first render.
+void BM_KeyboardCacheHit(benchmark::State& state) {
+    std::vector<std::pair<std::string, std::string>> btns;
+    for (int i = 0; i < state.range(0); ++i) {
+        btns.push_back({"Course " + std::to_string(i) + " (#" + std::to_string(i) + ")",
+                        encode_callback(CallbackAction::COURSE, i)});
+    }
+    KeyboardCache cache(16);
+    (void)cache.get("courses", KeyboardCache::Layout::COLUMN, btns);
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(cache.get("courses", KeyboardCache::Layout::COLUMN, btns));
+}
+BENCHMARK(BM_KeyboardCacheHit)->Arg(4)->Arg(30);
+
+// Admission check for a chat flooding /courses: everything past the burst is refused.
+void BM_RateLimiterFlood(benchmark::State& state) {
+    RateLimiter limiter(std::make_shared<RedisClient>("127.0.0.1", 0), "bench");
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(limiter.admit(42, RateLimiter::Class::LISTING));
+}
+BENCHMARK(BM_RateLimiterFlood);
+
+// What the flight recorder adds to every update: the scope and four phases.
+void BM_FlightRecord(benchmark::State& state) {
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        FlightScope flight("courses", 42);
+        for (auto p : {FlightRecorder::Phase::LOAD, FlightRecorder::Phase::AUTH, FlightRecorder::Phase::BACKEND,
+                       FlightRecorder::Phase::SEND}) {
+            FlightPhase phase(p);
+        }
+    }
+}
+BENCHMARK(BM_FlightRecord);
+
+// Mirrors the /users handler: format every user, then split into 3500-byte messages.
+void BM_UsersChunking(benchmark::State& state) {
+    json users = json::array();
+    for (int i = 0; i < state.range(0); ++i) {
+        users.push_back({{"id", i}, {"username", "user" + std::to_string(i)}, {"full_name", "Ivan Ivanov"}, {"is_blocked", i % 7 == 0}});
+    }
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        std::string msg = "Пользователи:\n";
+        for (auto& u : users) {
+            msg += "#" + std::to_string(u.value("id", 0)) + " ";
+            msg += u.value("username", "user");
+            auto fn = u.value("full_name", "");
+            if (!fn.empty()) msg += " (" + fn + ")";
+            msg += (u.value("is_blocked", false) ? " [blocked]" : "");
+            msg += "\n";
+        }
+        benchmark::DoNotOptimize(chunk_message(msg, 3500));
+    }
+}
+BENCHMARK(BM_UsersChunking)->Arg(100)->Arg(5000);
+
+json me_body() {
+    return {{"id", 42},
+            {"username", "ivan.ivanov"},
+            {"full_name", "Ivan Ivanovich Ivanov"},
+            {"email", "ivan.ivanov@example.com"},
+            {"is_blocked", false},
+            {"courses_count", 3},
+            {"attempts_count", 17}};
+}
+
+// The /me reply as it was built before per-update arenas.
+void BM_MeMessageStream(benchmark::State& state) {
+    const json j = me_body();
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        std::ostringstream msg;
+        msg << "Пользователь #" << j.value("id", 0) << "\n";
+        msg << "Username: " << j.value("username", "") << "\n";
+        msg << "Full name: " << j.value("full_name", "") << "\n";
+        msg << "Email: " << j.value("email", "") << "\n";
+        msg << "Blocked: " << (j.value("is_blocked", false) ? "yes" : "no") << "\n";
+        msg << "Courses: " << j.value("courses_count", 0) << "\n";
+        msg << "Attempts: " << j.value("attempts_count", 0);
+        benchmark::DoNotOptimize(msg.str());
+    }
+}
+BENCHMARK(BM_MeMessageStream);
+
+std::string_view bench_str_field(const json& j, const char* key) {
+    auto it = j.find(key);
+    if (it == j.end() || !it->is_string()) return {};
+    return it->get_ref<const std::string&>();
+}
+
+// Same reply built on the update's scratch arena; the only heap allocation
+// left is the final std::string handed to sendMessage.
+void BM_MeMessageArena(benchmark::State& state) {
+    const json j = me_body();
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        UpdateArena arena;
+        std::pmr::string msg(scratch());
+        msg += "Пользователь #";
+        append_int(msg, j.value("id", 0));
+        msg += "\nUsername: ";
+        msg += bench_str_field(j, "username");
+        msg += "\nFull name: ";
+        msg += bench_str_field(j, "full_name");
+        msg += "\nEmail: ";
+        msg += bench_str_field(j, "email");
+        msg += "\nBlocked: ";
+        msg += j.value("is_blocked", false) ? "yes" : "no";
+        msg += "\nCourses: ";
+        append_int(msg, j.value("courses_count", 0));
+        msg += "\nAttempts: ";
+        append_int(msg, j.value("attempts_count", 0));
+        benchmark::DoNotOptimize(std::string(msg));
+    }
+}
+BENCHMARK(BM_MeMessageArena);
+
+json users_rows(int n) {
+    json users = json::array();
+    for (int i = 0; i < n; ++i) {
+        users.push_back({{"id", i}, {"username", "user" + std::to_string(i)}, {"full_name", "Ivan Ivanov"}, {"is_blocked", i % 7 == 0}});
+    }
+    return users;
+}
+
+// One /users page of rows (TG_USERS_PAGE_SIZE 20) accumulated on the heap ...
+void BM_UsersPageRowsHeap(benchmark::State& state) {
+    const json users = users_rows(static_cast<int>(state.range(0)));
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        std::string rows;
+        for (auto& u : users) {
+            std::string line = "#" + std::to_string(u.value("id", 0)) + " " + u.value("username", "user");
+            auto fn = u.value("full_name", "");
+            if (!fn.empty()) line += " (" + fn + ")";
+            line += (u.value("is_blocked", false) ? " [blocked]" : "");
+            line += "\n";
+            rows += line;
+        }
+        benchmark::DoNotOptimize(std::string("Пользователи 1–20:\n") + rows);
+    }
+}
+BENCHMARK(BM_UsersPageRowsHeap)->Arg(20);
+
+// ... and on the scratch arena, as users_page() does now.
+void BM_UsersPageRowsArena(benchmark::State& state) {
+    const json users = users_rows(static_cast<int>(state.range(0)));
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        UpdateArena arena;
+        std::pmr::string rows(scratch());
+        std::pmr::string line(scratch());
+        for (auto& u : users) {
+            const auto fn = bench_str_field(u, "full_name");
+            line.assign("#");
+            append_int(line, u.value("id", 0));
+            line += ' ';
+            line += bench_str_field(u, "username");
+            if (!fn.empty()) {
+                line += " (";
+                line += fn;
+                line += ')';
+            }
+            if (u.value("is_blocked", false)) line += " [blocked]";
+            line += '\n';
+            rows += line;
+        }
+        std::string text = "Пользователи 1–20:\n";
+        text += rows;
+        benchmark::DoNotOptimize(text);
+    }
+}
+BENCHMARK(BM_UsersPageRowsArena)->Arg(20);
+
+std::string users_body(int n) {
+    json users = json::array();
+    for (int i = 0; i < n; ++i) {
+        users.push_back({{"id", i}, {"username", "user" + std::to_string(i)}, {"full_name", "Ivan Ivanov"}, {"is_blocked", i % 7 == 0}});
+    }
+    return users.dump();
+}
+
+void BM_UsersParseDom(benchmark::State& state) {
+    const std::string body = users_body(static_cast<int>(state.range(0)));
+    AllocCounter ac(state);
+    for (auto _ : state) benchmark::DoNotOptimize(json::parse(body));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_UsersParseDom)->Arg(100)->Arg(5000);
+
+// Same body fed in 16 KiB pieces (a typical curl write size) through JsonArrayStream,
+// parsing one element at a time as the /users handler does.
+void BM_UsersParseStream(benchmark::State& state) {
+    const std::string body = users_body(static_cast<int>(state.range(0)));
+    std::string_view all(body);
+    JsonArrayStream users([](std::string_view el) {
+        benchmark::DoNotOptimize(json::parse(el));
+        return true;
+    });
+    AllocCounter ac(state);
+    for (auto _ : state) {
+        users.reset();
+        for (std::size_t i = 0; i < all.size(); i += 16384) users.feed(all.substr(i, 16384));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_UsersParseStream)->Arg(100)->Arg(5000);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,234 @@
+// Offline replay of a captured update stream (TG_CAPTURE_FILE) through the bot's
+// handlers, against the same in-process fakes as tg_bench. Updates run one at a
+// time on this thread, paced by their capture timestamps, and each handler's
+// thread CPU time and heap allocations are reported.
+//
+//   tg_replay --capture FILE [--speed X] [--questions N] [--backend-latency-us N]
+//             [--login 0|1]
+//
+// --speed scales the captured gaps (1 = real time, 10 = ten times faster,
+// 0 = no pauses). With --login 1 (the default) every chat in the capture is
+// logged in against the fake auth service first, outside the report, since a
+// capture rarely starts at each user's /login. Course, test and answer ids in
+// callbacks come from the real backend, so taps the fakes do not know take the
+// handlers' error paths.
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tgbot/tgbot.h>
+
+#include "auth_client.h"
+#include "callback_data.h"
+#include "fake_servers.h"
+#include "main_client.h"
+#include "metrics.h"
+#include "redis_client.h"
+#include "session_store.h"
+#include "telegram_bot.h"
+#include "update_capture.h"
+
+namespace {
+
+// Heap allocations made by this thread; the fakes' server threads do not count.
+thread_local std::uint64_t t_allocs = 0;
+
+} // namespace
+
+void* operator new(std::size_t n) {
+    ++t_allocs;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Options {
+    std::string capture;
+    double speed{1.0};
+    int questions{10};
+    int backend_latency_us{0};
+    bool login{true};
+};
+
+Options parse_args(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string k = argv[i];
+        const std::string v = argv[i + 1];
+        if (k == "--capture") o.capture = v;
+        else if (k == "--speed") o.speed = std::max(0.0, std::stod(v));
+        else if (k == "--questions") o.questions = std::stoi(v);
+        else if (k == "--backend-latency-us") o.backend_latency_us = std::stoi(v);
+        else if (k == "--login") o.login = v != "0";
+        else std::cerr << "ignoring unknown option " << k << std::endl;
+    }
+    return o;
+}
+
+const char* step_name(CallbackAction a) {
+    switch (a) {
+        case CallbackAction::COURSE: return "cb_course";
+        case CallbackAction::TEST: return "cb_test";
+        case CallbackAction::ANSWER: return "cb_answer";
+        case CallbackAction::FINISH: return "cb_finish";
+        case CallbackAction::BACK_COURSES: return "cb_back_courses";
+        case CallbackAction::USERS_PAGE: return "cb_users_page";
+        case CallbackAction::NONE: break;
+    }
+    return "cb_invalid";
+}
+
+// The handler an update is routed to, as named in tg_updates_total.
+std::string handler_of(const TgBot::Update::Ptr& u) {
+    if (u->callbackQuery) {
+        CallbackData d;
+        return decode_callback(u->callbackQuery->data, &d) ? step_name(d.action) : "cb_invalid";
+    }
+    const std::string& text = u->message->text;
+    if (text.empty() || text[0] != '/') return "text";
+    auto end = text.find_first_of(" @");
+    return text.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+}
+
+std::int64_t chat_of(const TgBot::Update::Ptr& u) {
+    const auto& m = u->callbackQuery ? u->callbackQuery->message : u->message;
+    return m && m->chat ? m->chat->id : 0;
+}
+
+std::int64_t thread_cpu_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+struct Step {
+    std::uint64_t count{0};
+    std::int64_t cpu_ns{0};
+    std::uint64_t allocs{0};
+    std::unique_ptr<Histogram> wall{std::make_unique<Histogram>()};
+};
+
+TgBot::Update::Ptr command(std::int64_t chatId, const std::string& text) {
+    auto u = std::make_shared<TgBot::Update>();
+    u->message = std::make_shared<TgBot::Message>();
+    u->message->chat = std::make_shared<TgBot::Chat>();
+    u->message->chat->id = chatId;
+    u->message->text = text;
+    return u;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Options opt = parse_args(argc, argv);
+    if (opt.capture.empty()) {
+        std::cerr << "usage: tg_replay --capture FILE [--speed X] [--questions N] [--backend-latency-us N] [--login 0|1]"
+                  << std::endl;
+        return 1;
+    }
+    // Captured chats tap at their own pace, which a faster replay compresses.
+    ::setenv("TG_RATE_LIMIT", "0", 0);
+
+    std::vector<std::pair<std::int64_t, TgBot::Update::Ptr>> updates;
+    {
+        std::ifstream in(opt.capture);
+        if (!in) {
+            std::cerr << "cannot read " << opt.capture << std::endl;
+            return 1;
+        }
+        std::string line;
+        std::size_t bad = 0;
+        while (std::getline(in, line)) {
+            std::int64_t at = 0;
+            auto u = UpdateCapture::parse(line, &at);
+            if (u) {
+                updates.emplace_back(at, std::move(u));
+            } else if (!line.empty()) {
+                ++bad;
+            }
+        }
+        if (bad > 0) std::cerr << "skipped " << bad << " unreadable line(s)" << std::endl;
+    }
+
+    FakeBackend::Options bo;
+    bo.questions_per_attempt = opt.questions;
+    bo.latency_us = opt.backend_latency_us;
+    FakeBackend backend(bo);
+    FakeHttpServer http([&backend](const HttpRequest& r) { return backend.handle(r); });
+    FakeRedisServer redis;
+    if (!http.start() || !redis.start()) {
+        std::cerr << "failed to start the fakes" << std::endl;
+        return 1;
+    }
+    auto store = std::make_shared<SessionStore>(std::make_shared<RedisClient>("127.0.0.1", redis.port()));
+    FakeTelegram tg;
+    TelegramModuleBot bot("0:replay", store, AuthClient(http.base_url()), MainClient(http.base_url()), tg);
+
+    if (opt.login) {
+        std::set<std::int64_t> chats;
+        for (const auto& [at, u] : updates) chats.insert(chat_of(u));
+        for (auto chatId : chats) {
+            bot.process_update(command(chatId, "/login github"));
+            bot.process_update(command(chatId, "/courses"));
+        }
+    }
+
+    std::printf("tg_replay: %zu updates from %s, speed %s, backend latency %dus\n",
+                updates.size(),
+                opt.capture.c_str(),
+                opt.speed > 0 ? (std::to_string(opt.speed) + "x").c_str() : "unpaced",
+                opt.backend_latency_us);
+
+    std::map<std::string, Step> steps;
+    const auto started = std::chrono::steady_clock::now();
+    const std::int64_t first_at = updates.empty() ? 0 : updates.front().first;
+    for (const auto& [at, u] : updates) {
+        if (opt.speed > 0) {
+            const auto offset = std::chrono::duration<double, std::milli>(static_cast<double>(at - first_at) / opt.speed);
+            std::this_thread::sleep_until(started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+        }
+        Step& s = steps[handler_of(u)];
+        const std::uint64_t allocs = t_allocs;
+        const std::int64_t cpu = thread_cpu_ns();
+        {
+            ScopedTimer timer(*s.wall);
+            bot.process_update(u);
+        }
+        s.cpu_ns += thread_cpu_ns() - cpu;
+        s.allocs += t_allocs - allocs;
+        ++s.count;
+    }
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::printf("replayed in %.2fs, %llu messages sent\n", wall, static_cast<unsigned long long>(tg.sent()));
+    std::printf("%-18s %8s %12s %12s %12s %10s\n", "handler", "count", "cpu_ms", "cpu_us/upd", "allocs/upd", "p99_ms");
+    for (const auto& [name, s] : steps) {
+        const double n = static_cast<double>(s.count);
+        std::printf("%-18s %8llu %12.3f %12.1f %12.1f %10.3f\n",
+                    name.c_str(),
+                    static_cast<unsigned long long>(s.count),
+                    static_cast<double>(s.cpu_ns) / 1e6,
+                    static_cast<double>(s.cpu_ns) / 1e3 / n,
+                    static_cast<double>(s.allocs) / n,
+                    static_cast<double>(s.wall->quantile_us(0.99)) / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "redis_client.h"
+
+// Answers tapped in batched-answer mode, held in Redis until the backend has
+// them. List `<prefix>:answers:<chat>:<attempt>` keeps "<answer_id>:<value>"
+// entries in tap order; set `<prefix>:answers` names the lists that still have
+// entries, so whichever replica comes up next can flush them after a crash.
+//
+// Another replica may append to a list while this one flushes it, so entries
+// are only ever removed by position, and the index entry only once the list is
+// empty.
+class AnswerLog {
+public:
+    struct Pending {
+        int answer_id{0};
+        int value{0};
+    };
+    struct Attempt {
+        std::int64_t chat_id{0};
+        int attempt_id{0};
+    };
+
+    AnswerLog(std::shared_ptr<RedisClient> redis, const std::string& prefix);
+
+    // Number of entries waiting for the attempt after this one, 0 if Redis failed.
+    long long append(std::int64_t chatId, int attemptId, int answerId, int value);
+    // nullopt if Redis could not be read.
+    std::optional<std::vector<Pending>> pending(std::int64_t chatId, int attemptId);
+    // Forgets the first `n` of the `total` entries pending() returned; the
+    // index entry goes once nothing is left.
+    bool drop(std::int64_t chatId, int attemptId, std::size_t n, std::size_t total);
+    void discard(std::int64_t chatId, int attemptId);
+    // One SSCAN page of attempts with entries; `*cursor` starts and ends at "0".
+    std::vector<Attempt> scan(std::string* cursor, std::size_t count);
+
+private:
+    std::shared_ptr<RedisClient> redis_;
+    const std::string prefix_;
+    const std::string index_;
+
+    std::string key(std::int64_t chatId, int attemptId) const;
+    static std::string member(std::int64_t chatId, int attemptId);
+};
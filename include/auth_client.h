@@ -1,12 +1,23 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 
+#include "circuit_breaker.h"
+
+// Calls go through the "auth" circuit breaker; while it is open they fail at
+// once as if the service answered with HTTP 0.
 class AuthClient {
 public:
     explicit AuthClient(std::string base);
 
+    CircuitBreaker& breaker() const { return *breaker_; }
+    // Startup probe, outside the breaker: true if the service answers with
+    // anything below 500 within `timeout_ms`.
+    bool reachable(std::int32_t timeout_ms) const;
+
     struct LoginStartResult {
         enum class Kind { URL, CODE, ERROR };
         Kind kind{Kind::ERROR};
@@ -29,4 +40,7 @@ public:
 
 private:
     std::string base_;
+    std::int32_t timeout_ms_;
+    std::int32_t connect_timeout_ms_;
+    std::shared_ptr<CircuitBreaker> breaker_;
 };
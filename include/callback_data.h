@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Inline-button payloads are encoded as a single action byte followed by up to
+// two decimal arguments separated by ':' (e.g. "c12", "a345:2", "b").
+enum class CallbackAction : char {
+    NONE = 0,
+    COURSE = 'c',
+    TEST = 't',
+    ANSWER = 'a',
+    FINISH = 'f',
+    BACK_COURSES = 'b',
+    USERS_PAGE = 'u',
+};
+
+struct CallbackData {
+    CallbackAction action{CallbackAction::NONE};
+    int arg0{0};
+    int arg1{0};
+};
+
+std::string encode_callback(CallbackAction action, int arg0 = 0, int arg1 = 0);
+
+// Never throws and never allocates. Also accepts the legacy "course:<id>",
+// "test:<id>", "ans:<answer_id>:<value>", "finish:<id>" and "back:courses"
+// payloads still attached to keyboards sent by older builds.
+bool decode_callback(std::string_view data, CallbackData* out);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Counter;
+class Gauge;
+
+// Per-upstream breaker over the last `window` calls. It opens when at least
+// `min_calls` were seen and either the failure share or the slow-call share
+// crosses its threshold; after `open_ms` a single probe is let through
+// (half-open) and its outcome closes or re-opens the breaker.
+//
+// Configured from the environment, shared by all upstreams:
+//   TG_CB_WINDOW (20), TG_CB_MIN_CALLS (10), TG_CB_ERROR_RATE (0.5),
+//   TG_CB_SLOW_MS (3000), TG_CB_SLOW_RATE (0.8), TG_CB_OPEN_MS (10000).
+class CircuitBreaker {
+public:
+    enum class State { CLOSED = 0, HALF_OPEN = 1, OPEN = 2 };
+
+    struct Options {
+        std::size_t window{20};
+        std::size_t min_calls{10};
+        double error_rate{0.5};
+        std::chrono::milliseconds slow{3000};
+        double slow_rate{0.8};
+        std::chrono::milliseconds open_for{10000};
+
+        static Options from_env();
+    };
+
+    explicit CircuitBreaker(std::string upstream, Options opts = Options::from_env());
+
+    // False while open: the caller should not contact the upstream. In
+    // half-open state only the first caller gets through.
+    bool allow();
+    void record(bool ok, std::chrono::steady_clock::duration latency);
+
+    State state() const;
+    // True while calls would be turned away; unlike allow() it never takes the probe slot.
+    bool rejecting() const;
+
+private:
+    struct Outcome {
+        bool failed;
+        bool slow;
+    };
+
+    const std::string upstream_;
+    const Options opts_;
+    Gauge& state_gauge_;
+    Counter& opened_;
+    Counter& rejected_;
+
+    mutable std::mutex mtx_;
+    State state_{State::CLOSED};
+    std::vector<Outcome> ring_;
+    std::size_t next_{0};
+    std::size_t failed_{0};
+    std::size_t slow_{0};
+    bool probe_out_{false};
+    std::chrono::steady_clock::time_point open_until_{};
+
+    void trip(std::chrono::steady_clock::time_point now);
+    void reset_window();
+    void set_state(State s);
+};
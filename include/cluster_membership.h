@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "redis_client.h"
+
+// Splits the chat space between bot replicas. Each replica keeps a lease key
+// `<prefix>:member:<id>` alive with a TTL and lists itself in `<prefix>:members`;
+// the live members are placed on a consistent-hash ring and a chat belongs to
+// the first member clockwise of its hash. Members that stop heartbeating drop
+// off once their lease expires and their chats move to the survivors.
+//
+// Configured from the environment:
+//   TG_INSTANCE_ID (hostname:pid), TG_CLUSTER_HEARTBEAT_SEC (5),
+//   TG_CLUSTER_TTL_SEC (15), TG_CLUSTER_VNODES (64).
+class ClusterMembership {
+public:
+    ClusterMembership(std::shared_ptr<RedisClient> redis, const std::string& prefix);
+    ~ClusterMembership();
+
+    // Registers this replica and keeps the lease and member list fresh from a
+    // background thread. Until then the replica owns every chat.
+    void start();
+    // Stops heartbeating and drops the lease so the other replicas take over
+    // without waiting for the TTL.
+    void stop();
+
+    bool owns(std::int64_t chatId) const;
+    const std::string& id() const { return id_; }
+    std::size_t members() const;
+
+private:
+    std::shared_ptr<RedisClient> redis_;
+    const std::string members_key_;
+    const std::string member_prefix_;
+    const std::string id_;
+    const std::chrono::seconds heartbeat_every_;
+    const int ttl_sec_;
+    const int vnodes_;
+    std::jthread thread_;
+
+    mutable std::mutex mtx_;
+    std::vector<std::string> live_;
+    // (point, member) sorted by point.
+    std::vector<std::pair<std::uint64_t, std::string>> ring_;
+
+    void heartbeat();
+    void rebuild(std::vector<std::string> live);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "task.h"
+
+// Fixed pool of worker threads, each with its own FIFO. Tasks are sharded by
+// key (the chat id) and chained per key: a chat's next task starts only once the
+// previous one has finished, even if that one is a coroutine suspended on I/O,
+// while different chats proceed in parallel. Until start() is called, tasks run
+// inline.
+class Dispatcher {
+public:
+    Dispatcher() = default;
+    ~Dispatcher();
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    void start(std::size_t workers);
+    // Waits until every submitted job has finished; false if `deadline` passed first.
+    bool drain(std::chrono::steady_clock::time_point deadline);
+    // Runs what is already queued, then joins the workers. Later tasks run inline.
+    void stop();
+    void submit(std::int64_t key, std::function<void()> task);
+    // `job` is invoked on the key's worker; the returned coroutine may resume elsewhere.
+    void submit_async(std::int64_t key, std::function<Task<void>()> job);
+
+private:
+    struct Worker {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> queue;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> stop_{false};
+
+    std::mutex chains_mtx_;
+    std::condition_variable chains_idle_;
+    std::unordered_map<std::int64_t, std::deque<std::function<Task<void>()>>> chains_;
+
+    void post(std::int64_t key, std::function<void()> task);
+    void start_next(std::int64_t key);
+    Task<void> run_chain(std::int64_t key);
+    void run_worker(Worker& w);
+};
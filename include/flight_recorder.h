@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Always-on record of the last updates handled: per update a hash of the chat
+// id, the handler name, and the time spent in each phase (session load/save,
+// auth, main backend, Telegram send). Updates write into a fixed ring without
+// locks; dump() copies it out to a JSON-lines file, on SIGUSR1 or when the
+// watcher sees p99 update time over its threshold.
+//
+// Like the open trace, the update's draft is thread-local and follows the
+// coroutine across IoPool hops (detach_flight / AdoptFlight).
+//
+// Configured from the environment:
+//   TG_FLIGHT_RECORDS (4096, rounded up to a power of two; 0 = off),
+//   TG_FLIGHT_DIR (/tmp), TG_FLIGHT_P99_MS (2000, 0 = no automatic dumps),
+//   TG_FLIGHT_CHECK_SEC (10), TG_FLIGHT_COOLDOWN_SEC (300).
+class FlightRecorder {
+public:
+    enum class Phase { LOAD = 0, AUTH, BACKEND, SEND };
+    static constexpr std::size_t kPhases = 4;
+
+    static FlightRecorder& instance();
+    ~FlightRecorder();
+
+    bool enabled() const { return slots_ != nullptr; }
+
+    // Writes the ring, oldest first, to a new file in TG_FLIGHT_DIR; returns
+    // its path, or an empty string if nothing could be written.
+    std::string dump(const char* reason);
+
+    // Starts the p99 watcher thread; stop() (or exit) ends it.
+    void start();
+    void stop();
+
+private:
+    friend class FlightScope;
+
+    // Payload words of a slot; the handler name takes the last three.
+    static constexpr std::size_t kWords = 10;
+    static constexpr std::size_t kNameWords = 3;
+
+    // Seqlock per slot: odd while a writer is in it, 2 * (ticket + 1) once
+    // ticket's record is complete.
+    struct Slot {
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<std::uint64_t> words[kWords];
+    };
+    struct Record {
+        std::uint64_t ticket{0};
+        std::uint64_t words[kWords]{};
+    };
+
+    FlightRecorder();
+
+    std::unique_ptr<Slot[]> slots_;
+    std::uint64_t mask_{0};
+    std::atomic<std::uint64_t> next_{0};
+    const std::uint64_t salt_;
+    const std::string dir_;
+    std::jthread watcher_;
+
+    void commit(const std::uint64_t (&words)[kWords]);
+    // Complete records with a ticket at or after `from`, oldest first.
+    std::vector<Record> snapshot(std::uint64_t from) const;
+    void watch(std::stop_token stop);
+};
+
+// One update's record while it runs.
+struct FlightDraft {
+    const char* command{nullptr};
+    std::int64_t chat_id{0};
+    std::int64_t start_unix_ns{0};
+    std::chrono::steady_clock::time_point started;
+    std::uint64_t phase_ns[FlightRecorder::kPhases]{};
+    bool in_phase{false};
+};
+
+// Opens the update's draft; the record is committed when the scope closes.
+// Nested scopes (a handler run inside another update) are no-ops.
+class FlightScope {
+public:
+    FlightScope(const char* command, std::int64_t chat_id);
+    ~FlightScope();
+
+    FlightScope(const FlightScope&) = delete;
+    FlightScope& operator=(const FlightScope&) = delete;
+
+private:
+    FlightDraft draft_;
+    bool active_{false};
+};
+
+// Adds the time until it closes to `phase` of the current update, if any.
+// Inside another phase it adds nothing, so a refresh within a backend call
+// is not counted twice.
+class FlightPhase {
+public:
+    explicit FlightPhase(FlightRecorder::Phase phase);
+    ~FlightPhase();
+
+    FlightPhase(const FlightPhase&) = delete;
+    FlightPhase& operator=(const FlightPhase&) = delete;
+
+private:
+    FlightDraft* draft_{nullptr};
+    FlightRecorder::Phase phase_{FlightRecorder::Phase::LOAD};
+    std::chrono::steady_clock::time_point started_;
+};
+
+FlightDraft* detach_flight();
+
+class AdoptFlight {
+public:
+    explicit AdoptFlight(FlightDraft* draft);
+    ~AdoptFlight();
+
+    AdoptFlight(const AdoptFlight&) = delete;
+    AdoptFlight& operator=(const AdoptFlight&) = delete;
+
+private:
+    FlightDraft* prev_;
+};
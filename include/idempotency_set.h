@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Remembers keys for a short TTL so a repeated delivery (a retapped button, a
+// redelivered update) can be dropped. In-memory and per process.
+class IdempotencySet {
+public:
+    IdempotencySet(std::chrono::milliseconds ttl, std::size_t max_entries);
+
+    // True the first time `key` is seen within the TTL; false for repeats.
+    bool first_seen(const std::string& key);
+    // Drops `key` early, e.g. when the guarded work failed and a retry is wanted.
+    void forget(const std::string& key);
+
+private:
+    std::chrono::milliseconds ttl_;
+    std::size_t max_entries_;
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> keys_;
+    // Insertion order doubles as expiry order since every key has the same TTL.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> order_;
+
+    void expire(std::chrono::steady_clock::time_point now);
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "flight_recorder.h"
+#include "tracing.h"
+#include "update_arena.h"
+
+// Threads for blocking calls (Redis, HTTP, Bot API) made from coroutines.
+// `co_await pool.run(fn)` runs fn on a pool thread and resumes the coroutine
+// there, so the dispatcher worker that started the handler is free meanwhile.
+// Until start() is called everything runs inline on the awaiting thread.
+class IoPool {
+public:
+    IoPool() = default;
+    ~IoPool();
+
+    IoPool(const IoPool&) = delete;
+    IoPool& operator=(const IoPool&) = delete;
+
+    void start(std::size_t threads);
+    // Finishes the queued calls and joins the threads; later calls run inline.
+    void stop();
+    bool started() const { return !threads_.empty(); }
+    void post(std::function<void()> fn);
+
+    template <typename F>
+    class Op;
+
+    template <typename F>
+    Op<F> run(F fn) {
+        return Op<F>(*this, std::move(fn));
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    std::vector<std::thread> threads_;
+    bool stop_{false};
+
+    void loop();
+};
+
+template <typename F>
+class IoPool::Op {
+public:
+    using R = std::invoke_result_t<F&>;
+
+    Op(IoPool& pool, F fn) : pool_(pool), fn_(std::move(fn)) {}
+
+    bool await_ready() const noexcept { return !pool_.started(); }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        // The open trace, scratch arena and flight draft (thread-local) travel
+        // with the coroutine to the pool thread.
+        ActiveTrace* trace = detach_trace();
+        UpdateArena* arena = detach_arena();
+        FlightDraft* flight = detach_flight();
+        pool_.post([this, h, trace, arena, flight]() {
+            AdoptTrace adopt(trace);
+            AdoptArena adopt_arena(arena);
+            AdoptFlight adopt_flight(flight);
+            invoke();
+            h.resume();
+        });
+    }
+
+    R await_resume() {
+        if (!done_) invoke();
+        if (error_) std::rethrow_exception(error_);
+        if constexpr (!std::is_void_v<R>) return std::move(*result_);
+    }
+
+private:
+    using Stored = std::conditional_t<std::is_void_v<R>, bool, R>;
+
+    IoPool& pool_;
+    F fn_;
+    std::optional<Stored> result_;
+    std::exception_ptr error_;
+    bool done_{false};
+
+    void invoke() {
+        done_ = true;
+        try {
+            if constexpr (std::is_void_v<R>) {
+                fn_();
+            } else {
+                result_.emplace(fn_());
+            }
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+    }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Push-style splitter for a top-level JSON array: bytes are fed as they arrive and
+// each complete element is handed to the callback as raw JSON text, so only one
+// element is ever buffered regardless of the array length.
+class JsonArrayStream {
+public:
+    // Return false from the callback to stop consuming the stream.
+    using ElementFn = std::function<bool(std::string_view element)>;
+
+    explicit JsonArrayStream(ElementFn on_element, std::size_t max_element = 1 << 20);
+
+    // Returns false once the stream is malformed, an element exceeds max_element or
+    // the callback asked to stop. Input that is not an array is skipped (returns true).
+    bool feed(std::string_view chunk);
+
+    void reset();
+
+    bool is_array() const { return state_ != State::START && state_ != State::NOT_ARRAY; }
+    bool complete() const { return state_ == State::DONE; }
+    bool failed() const { return state_ == State::ERROR; }
+    std::size_t count() const { return count_; }
+
+private:
+    enum class State { START, NOT_ARRAY, BETWEEN, ELEMENT, DONE, ERROR, STOPPED };
+
+    ElementFn on_element_;
+    std::size_t max_element_;
+    State state_{State::START};
+    std::string cur_;
+    int depth_{0};
+    bool in_string_{false};
+    bool escape_{false};
+    bool scalar_{false};
+    std::size_t count_{0};
+
+    bool emit(std::string_view tail);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tgbot/tgbot.h>
+
+// One button per row; each pair is (text, callback_data).
+TgBot::InlineKeyboardMarkup::Ptr make_kb(const std::vector<std::pair<std::string, std::string>>& buttons);
+
+// All buttons on a single row, e.g. ◀/▶ pagination.
+TgBot::InlineKeyboardMarkup::Ptr make_kb_row(const std::vector<std::pair<std::string, std::string>>& buttons);
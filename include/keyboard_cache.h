@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tgbot/tgbot.h>
+
+// Interns inline keyboards by content: identical button lists share one markup
+// object instead of rebuilding the markup and a button per row on every
+// render. The returned markup is shared and must not be modified.
+//
+// Entries carry a scope (e.g. "courses", "tests:12") so a change to a listing
+// can drop the keyboards built from it; the rest age out of the LRU. Sized by
+// TG_KEYBOARD_CACHE (1024, 0 = off).
+class KeyboardCache {
+public:
+    enum class Layout { COLUMN, ROW };
+    using Buttons = std::vector<std::pair<std::string, std::string>>;
+
+    explicit KeyboardCache(std::size_t max_entries);
+
+    TgBot::InlineKeyboardMarkup::Ptr get(const std::string& scope, Layout layout, const Buttons& buttons);
+    void invalidate(const std::string& scope);
+
+    std::size_t size() const;
+
+private:
+    struct Entry {
+        std::uint64_t hash;
+        Layout layout;
+        std::string scope;
+        Buttons buttons;
+        TgBot::InlineKeyboardMarkup::Ptr markup;
+    };
+    using Lru = std::list<Entry>;
+
+    const std::size_t max_entries_;
+    mutable std::mutex mtx_;
+    Lru lru_;
+    std::unordered_multimap<std::uint64_t, Lru::iterator> index_;
+
+    static std::uint64_t hash(Layout layout, const Buttons& buttons);
+    void erase(Lru::iterator it);
+};
@@ -1,22 +1,79 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
 
+#include "circuit_breaker.h"
+#include "response_cache.h"
+
+// Per-call curl limits; 0 keeps curl's default (no total timeout).
+struct CallLimits {
+    std::int32_t timeout_ms{0};
+    std::int32_t connect_timeout_ms{0};
+};
+
+// Every verb goes through the "main" circuit breaker; while it is open calls
+// return at once with status 0 and error message "circuit open".
+//
+// GETs are conditional: bodies that came with an ETag or Last-Modified are
+// kept per (bearer, path) and a 304 is answered from that copy as a 200.
+// TG_HTTP_CACHE_ENTRIES (2000, 0 = off) and TG_HTTP_CACHE_MAX_BODY (262144)
+// bound the cache.
 class MainClient {
 public:
     explicit MainClient(std::string base);
 
-    cpr::Response get(const std::string& path, const std::string& bearer);
-    cpr::Response del(const std::string& path, const std::string& bearer);
-    cpr::Response post(const std::string& path, const std::string& bearer, const nlohmann::json* body = nullptr);
+    CircuitBreaker& breaker() const { return *breaker_; }
+    // Startup probe, outside the breaker: true if the service answers with
+    // anything below 500 within `timeout_ms`.
+    bool reachable(std::int32_t timeout_ms) const;
+
+    // A GET with its body parsed; `body` is nullptr unless the status is 200
+    // and the body is JSON. A revalidated hit shares the cached document and
+    // leaves `response.text` empty.
+    struct JsonGet {
+        cpr::Response response;
+        std::shared_ptr<const nlohmann::json> body;
+    };
+
+    cpr::Response get(const std::string& path, const std::string& bearer, const CallLimits& limits = {});
+    JsonGet get_json(const std::string& path, const std::string& bearer, const CallLimits& limits = {});
+    // Hands the body to `on_data` as it arrives instead of buffering it in
+    // Response::text; returning false aborts the transfer.
+    cpr::Response get_stream(const std::string& path,
+                             const std::string& bearer,
+                             const std::function<bool(std::string_view)>& on_data,
+                             const CallLimits& limits = {});
+    cpr::Response del(const std::string& path, const std::string& bearer, const CallLimits& limits = {});
+    cpr::Response post(const std::string& path,
+                       const std::string& bearer,
+                       const nlohmann::json* body = nullptr,
+                       const CallLimits& limits = {});
     cpr::Response post_params(const std::string& path,
                               const std::string& bearer,
-                              const cpr::Parameters& params);
-    cpr::Response patch(const std::string& path, const std::string& bearer, const nlohmann::json& body);
+                              const cpr::Parameters& params,
+                              const CallLimits& limits = {});
+    cpr::Response patch(const std::string& path,
+                        const std::string& bearer,
+                        const nlohmann::json& body,
+                        const CallLimits& limits = {});
 
 private:
     std::string base_;
+    std::shared_ptr<CircuitBreaker> breaker_;
+    std::shared_ptr<ResponseCache> cache_;
+
+    // Sets `*entry` to the cache entry the body came from (a 304, answered as a
+    // 200 and replayed into `on_data`) or was just stored as.
+    cpr::Response cached_get(const std::string& path,
+                             const std::string& bearer,
+                             const CallLimits& limits,
+                             const std::function<bool(std::string_view)>* on_data,
+                             std::shared_ptr<const ResponseCache::Entry>* entry);
 };
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Prometheus-style metrics. Registration takes a lock; updating a metric never does,
+// so callers should look a metric up once and keep the reference.
+
+class Counter {
+public:
+    void inc(std::uint64_t n = 1);
+    std::uint64_t value() const;
+
+private:
+    static constexpr std::size_t kShards = 16;
+    struct alignas(64) Shard {
+        std::atomic<std::uint64_t> v{0};
+    };
+    std::array<Shard, kShards> shards_{};
+};
+
+class Gauge {
+public:
+    void set(double v) { v_.store(v, std::memory_order_relaxed); }
+    void add(double d);
+    double value() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> v_{0.0};
+};
+
+// Log-linear (HDR-style) histogram over microseconds: 4 sub-buckets per power of two,
+// i.e. roughly 25% relative precision from 1us up to ~18 minutes.
+class Histogram {
+public:
+    static constexpr std::size_t kBuckets = 120;
+
+    void observe_us(std::uint64_t us);
+    void observe(std::chrono::steady_clock::duration d);
+
+    std::uint64_t count() const;
+    std::uint64_t sum_us() const { return sum_us_.load(std::memory_order_relaxed); }
+    // Upper bound (in microseconds) of the bucket holding the q-th quantile, 0 if empty.
+    std::uint64_t quantile_us(double q) const;
+    // Number of samples strictly below 2^k microseconds.
+    std::uint64_t count_below_pow2(int k) const;
+
+    static std::size_t bucket_for(std::uint64_t us);
+    static std::uint64_t bucket_upper_us(std::size_t idx);
+
+private:
+    std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+    std::atomic<std::uint64_t> sum_us_{0};
+};
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& h) : h_(h), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { h_.observe(std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& h_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    // Returns the same object for the same (name, labels) pair. `labels` is the
+    // rendered label set without braces, e.g. metric_label("verb", "GET").
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    // Prometheus text exposition format 0.0.4.
+    std::string render() const;
+
+private:
+    enum class Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type{Type::COUNTER};
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    mutable std::mutex mtx_;
+    std::vector<std::unique_ptr<Family>> families_;
+
+    Series& series_for(const std::string& name, const std::string& help, Type type, const std::string& labels);
+};
+
+std::string metric_label(const std::string& key, const std::string& value);
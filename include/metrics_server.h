@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Minimal blocking HTTP/1.0 listener serving GET /metrics from MetricsRegistry,
+// plus probes for an orchestrator: GET /health answers 200 while the process
+// is up, GET /ready answers 200 only in the READY state and 503 otherwise.
+class MetricsServer {
+public:
+    enum class Readiness { STARTING = 0, READY = 1, DRAINING = 2 };
+
+    MetricsServer(std::string host, int port);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // Binds the socket and starts the accept loop on a background thread.
+    bool start();
+    // Closes the listener and waits for the accept loop and open connections.
+    void stop();
+
+    void set_readiness(Readiness r);
+
+private:
+    std::string host_;
+    int port_{0};
+    int listen_fd_{-1};
+    std::atomic<Readiness> readiness_{Readiness::STARTING};
+    std::atomic<bool> stopping_{false};
+    std::thread acceptor_;
+    std::mutex conn_mtx_;
+    std::condition_variable conn_cv_;
+    int active_{0};
+
+    void serve();
+    void handle(int fd);
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "redis_client.h"
+
+// Durable queue of outbound chat messages on a Redis stream (`<prefix>:outbox`)
+// read through the consumer group "senders". An entry stays pending until it is
+// acked after delivery, so a sender that dies mid-batch leaves its entries for
+// reclaim() by another sender: delivery is at least once.
+//
+// TG_OUTBOX_MAXLEN (100000) caps the stream length.
+class OutboxStore {
+public:
+    struct Message {
+        std::string id;
+        std::int64_t chat_id{0};
+        std::string text;
+    };
+
+    OutboxStore(std::shared_ptr<RedisClient> redis, const std::string& prefix, std::string consumer);
+
+    // Creates the consumer group if needed; false if Redis is unreachable.
+    bool ensure_group();
+    bool enqueue(std::int64_t chatId, const std::string& text);
+    // Entries not yet handed to any sender.
+    std::vector<Message> read(std::size_t count);
+    // Entries another sender took but did not ack within `min_idle`.
+    std::vector<Message> reclaim(std::chrono::milliseconds min_idle, std::size_t count);
+    bool ack(const std::string& id);
+
+private:
+    std::shared_ptr<RedisClient> redis_;
+    const std::string stream_;
+    const std::string group_{"senders"};
+    const std::string consumer_;
+    const long long maxlen_;
+    std::string claim_cursor_{"0-0"};
+
+    static std::vector<Message> to_messages(const std::vector<RedisClient::StreamEntry>& entries);
+};
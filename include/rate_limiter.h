@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "redis_client.h"
+
+class Counter;
+
+// Admission control for incoming updates, checked before any session load or
+// backend call. Each chat gets a token bucket per command class, and one
+// process-wide bucket caps the total; both are in memory, so a flood costs a
+// hash lookup per update. With TG_RATE_REDIS=1 an admitted update is also
+// counted in a Redis sliding window per chat and class, shared by replicas.
+//
+// Configured from the environment:
+//   TG_RATE_LIMIT (1), TG_RATE_<CLASS>_PER_MIN / TG_RATE_<CLASS>_BURST for
+//   ACCOUNT (12/5), LISTING (30/5), WRITE (60/10), QUIZ (240/30), UNKNOWN (12/3)
+//   where a rate of 0 leaves the class unlimited,
+//   TG_RATE_GLOBAL_PER_SEC (0 = no cap), TG_RATE_MAX_BUCKETS (200000),
+//   TG_RATE_REDIS (0).
+class RateLimiter {
+public:
+    enum class Class { ACCOUNT = 0, LISTING, WRITE, QUIZ, UNKNOWN };
+    static constexpr std::size_t kClasses = 5;
+
+    // REJECT is returned for the first refused update after an admitted one,
+    // so the caller can tell the chat once; later ones are REJECT_QUIET.
+    enum class Verdict { ADMIT, REJECT, REJECT_QUIET };
+
+    RateLimiter(std::shared_ptr<RedisClient> redis, const std::string& prefix);
+
+    // The class a command or callback handler name falls under.
+    static Class classify(std::string_view handler);
+
+    Verdict admit(std::int64_t chatId, Class c);
+    // The shared window; true when it is off or Redis cannot be reached.
+    bool admit_shared(std::int64_t chatId, Class c);
+    bool shared() const { return enabled_ && shared_; }
+
+private:
+    struct Limit {
+        double per_sec{0};
+        double burst{0};
+    };
+    struct Bucket {
+        double tokens{0};
+        std::chrono::steady_clock::time_point last;
+        bool warned{false};
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::uint64_t, Bucket> buckets;
+    };
+    static constexpr std::size_t kShards = 16;
+
+    std::shared_ptr<RedisClient> redis_;
+    const std::string prefix_;
+    const bool enabled_;
+    const bool shared_;
+    const std::size_t max_per_shard_;
+    std::array<Limit, kClasses> limits_{};
+    std::array<Counter*, kClasses> limited_{};
+    std::array<Shard, kShards> shards_;
+
+    Limit global_;
+    std::mutex global_mtx_;
+    Bucket global_bucket_;
+
+    // Takes a token from `b`; refills it first for the time since its last use.
+    static bool take(Bucket& b, const Limit& l, std::chrono::steady_clock::time_point now);
+    // Drops buckets that have refilled completely, as they behave like new ones.
+    void prune(Shard& sh, std::chrono::steady_clock::time_point now);
+};
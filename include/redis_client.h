@@ -1,13 +1,29 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
+// Keeps up to TG_REDIS_POOL (TG_WORKERS + TG_IO_THREADS) connections open and
+// reuses them across commands; callers beyond that wait up to
+// TG_REDIS_ACQUIRE_MS (2000) for a free connection, then fail the command.
 class RedisClient {
 public:
     explicit RedisClient(std::string host, int port);
+    ~RedisClient();
+
+    RedisClient(const RedisClient&) = delete;
+    RedisClient& operator=(const RedisClient&) = delete;
+
+    // Opens idle connections until `n` are pooled (capped at the pool size);
+    // returns how many are open.
+    std::size_t warm(std::size_t n);
+    std::size_t pool_size() const { return pool_max_; }
 
     bool ping();
     std::optional<std::string> get(const std::string& key);
@@ -16,8 +32,56 @@ public:
     long long sadd(const std::string& setKey, const std::string& member);
     long long srem(const std::string& setKey, const std::string& member);
     std::vector<std::string> smembers(const std::string& setKey);
+    // One SSCAN step from `*cursor`, leaving the next cursor there ("0" once done).
+    // Members may repeat across steps.
+    std::vector<std::string> sscan(const std::string& setKey, std::string* cursor, std::size_t count);
+    // One value per key, nullopt for missing keys; empty on errors.
+    std::vector<std::optional<std::string>> mget(const std::vector<std::string>& keys);
+    bool expire(const std::string& key, int ttlSeconds);
+    // Runs a Lua script that returns an integer; nullopt on errors.
+    std::optional<long long> eval_int(const std::string& script,
+                                      const std::vector<std::string>& keys,
+                                      const std::vector<std::string>& args);
+
+    // Lists. rpush returns the new length, 0 on errors.
+    long long rpush(const std::string& key, const std::string& value);
+    // nullopt on errors, so an empty list can be told apart from a failed read.
+    std::optional<std::vector<std::string>> lrange(const std::string& key, long long start, long long stop);
+    bool ltrim(const std::string& key, long long start, long long stop);
+
+    // Streams. Reads return an empty vector on errors as well as when there is nothing to read.
+    struct StreamEntry {
+        std::string id;
+        std::vector<std::pair<std::string, std::string>> fields;
+
+        const std::string* field(const std::string& name) const;
+    };
+    // Returns the new entry id. maxlen > 0 trims the stream approximately.
+    std::optional<std::string> xadd(const std::string& stream,
+                                    const std::vector<std::pair<std::string, std::string>>& fields,
+                                    long long maxlen = 0);
+    // Creates the group (and the stream) at "0", so entries added before the
+    // group existed are still delivered; an existing group counts as success.
+    bool xgroup_create(const std::string& stream, const std::string& group);
+    // New entries for `consumer`, without blocking.
+    std::vector<StreamEntry> xreadgroup(const std::string& group,
+                                        const std::string& consumer,
+                                        const std::string& stream,
+                                        std::size_t count);
+    long long xack(const std::string& stream, const std::string& group, const std::string& id);
+    // Takes over entries pending longer than `min_idle_ms`, scanning from
+    // `*cursor` and leaving the next cursor there ("0-0" once done).
+    std::vector<StreamEntry> xautoclaim(const std::string& stream,
+                                        const std::string& group,
+                                        const std::string& consumer,
+                                        long long min_idle_ms,
+                                        std::string* cursor,
+                                        std::size_t count);
 
 private:
+    // Exposes the RESP encoder/parser to the micro-benchmarks.
+    friend struct RedisClientBenchAccess;
+
     struct Resp {
         enum class Type { SimpleString, Error, Integer, BulkString, Array, Null };
         Type type{Type::Null};
@@ -28,12 +92,24 @@ private:
 
     std::string host_;
     int port_{6379};
+    const std::size_t pool_max_;
+    const std::chrono::milliseconds acquire_timeout_;
+
     std::mutex mtx_;
+    std::condition_variable pool_cv_;
+    std::vector<int> idle_;
+    std::size_t open_{0};
 
     static std::string encode(const std::vector<std::string>& args);
     static bool read_line(int fd, std::string& line);
     static bool read_n(int fd, std::string& out, std::size_t n);
     static std::optional<Resp> parse_resp(int fd);
+    static std::vector<StreamEntry> stream_entries(const Resp& list);
     static int connect_tcp(const std::string& host, int port);
+    // A pooled connection (`*reused`) or a new one; -1 if connecting failed or
+    // none came free in time.
+    int acquire(bool* reused);
+    void release(int fd, bool healthy);
+    static bool send_all(int fd, const std::string& payload);
     std::optional<Resp> cmd(const std::vector<std::string>& args);
 };
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cpr/cpr.h>
+#include <nlohmann/json.hpp>
+
+#include "auth_client.h"
+#include "io_pool.h"
+#include "main_client.h"
+#include "session.h"
+#include "session_store.h"
+
+// Main-backend calls made on behalf of a chat. Every call gets the endpoint's
+// timeouts; a 401 triggers one token refresh (saved to the store) and a replay;
+// GET/DELETE are retried with jittered backoff on transport errors and 5xx; and
+// a slow GET can be hedged with a second identical request. Retries stop as
+// soon as the main backend's circuit breaker opens.
+//
+// Configured from the environment:
+//   TG_HTTP_TIMEOUT_MS (5000), TG_HTTP_CONNECT_TIMEOUT_MS (1000),
+//   TG_HTTP_TIMEOUTS ("/api/users=8000,/api/questions=2000", longest prefix wins),
+//   TG_HTTP_RETRIES (2), TG_HTTP_BACKOFF_MS (100), TG_HTTP_HEDGE_MS (0 = off),
+//   TG_HTTP_HEDGE_THREADS (8, the threads hedged GETs run on).
+class RequestExecutor {
+public:
+    RequestExecutor(MainClient& main, AuthClient& auth, std::shared_ptr<SessionStore> store);
+
+    // Waits for hedged requests still in flight; later GETs are not hedged.
+    void shutdown();
+
+    cpr::Response get(std::int64_t chatId, Session& s, const std::string& path);
+    MainClient::JsonGet get_json(std::int64_t chatId, Session& s, const std::string& path);
+    // Transient failures are retried only while nothing has reached `on_data`;
+    // `on_restart` runs before a replay so the consumer can drop partial state.
+    cpr::Response get_stream(std::int64_t chatId,
+                             Session& s,
+                             const std::string& path,
+                             const std::function<bool(std::string_view)>& on_data,
+                             const std::function<void()>& on_restart);
+    cpr::Response del(std::int64_t chatId, Session& s, const std::string& path);
+    cpr::Response post(std::int64_t chatId, Session& s, const std::string& path, const nlohmann::json* body = nullptr);
+    cpr::Response post_params(std::int64_t chatId, Session& s, const std::string& path, const cpr::Parameters& params);
+    cpr::Response patch(std::int64_t chatId, Session& s, const std::string& path, const nlohmann::json& body);
+
+    // Swaps in a new token pair using the session's refresh token, and
+    // re-reads the identity with it.
+    bool refresh(Session& s);
+    // Sets s.user_id and s.role from /api/users/me; the HTTP status, or -1 if
+    // the body did not carry an id.
+    int identify(std::int64_t chatId, Session& s);
+
+private:
+    MainClient& main_;
+    AuthClient& auth_;
+    std::shared_ptr<SessionStore> store_;
+
+    CallLimits defaults_;
+    std::vector<std::pair<std::string, std::int32_t>> timeouts_;
+    int retries_;
+    std::int32_t backoff_ms_;
+    std::int32_t hedge_ms_;
+    // Both requests of a hedged GET run here; the loser may outlive its caller.
+    IoPool hedges_;
+
+    CallLimits limits_for(const std::string& path) const;
+    // With `parse`, the winner's body comes parsed (shared with the response
+    // cache on a revalidated hit); otherwise `body` is nullptr.
+    MainClient::JsonGet hedged_get(const std::string& path, const std::string& bearer, const CallLimits& limits, bool parse);
+
+    // `replay` says whether the call may be repeated after a transient failure.
+    template <typename Call>
+    cpr::Response execute(std::int64_t chatId, Session& s, const std::function<bool()>& replay, Call&& call);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+// LRU of GET bodies that came with an ETag or Last-Modified, keyed by caller
+// scope and path, so the next request can be conditional and a 304 reuses the
+// stored body (and its parsed JSON, built at most once per entry).
+class ResponseCache {
+public:
+    class Entry {
+    public:
+        Entry(std::string etag, std::string last_modified, std::string body);
+
+        const std::string etag;
+        const std::string last_modified;
+        const std::string body;
+
+        // Parsed body, or nullptr if it is not JSON.
+        std::shared_ptr<const nlohmann::json> json() const;
+
+    private:
+        mutable std::once_flag parse_once_;
+        mutable std::shared_ptr<const nlohmann::json> parsed_;
+    };
+
+    ResponseCache(std::size_t max_entries, std::size_t max_body);
+
+    // A key that separates callers without keeping their bearer token around.
+    static std::string key(std::string_view scope, std::string_view path);
+
+    bool enabled() const { return max_entries_ > 0; }
+    std::size_t max_body() const { return max_body_; }
+
+    std::shared_ptr<const Entry> find(const std::string& key);
+    // Stores (or replaces) the entry; a body over max_body() or without
+    // validators is dropped instead.
+    std::shared_ptr<const Entry> put(const std::string& key,
+                                     std::string etag,
+                                     std::string last_modified,
+                                     std::string body);
+    void erase(const std::string& key);
+
+private:
+    using Lru = std::list<std::pair<std::string, std::shared_ptr<const Entry>>>;
+
+    const std::size_t max_entries_;
+    const std::size_t max_body_;
+    std::mutex mtx_;
+    Lru lru_;
+    std::unordered_map<std::string, Lru::iterator> index_;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include <nlohmann/json.hpp>
@@ -12,11 +13,16 @@ struct Session {
     std::string login_type;
     std::string access_token;
     std::string refresh_token;
+    // Backend identity from /api/users/me, filled at login and on token refresh.
+    int user_id{-1};
+    std::string role;
 
     int current_course_id{-1};
     int current_test_id{-1};
     int current_attempt_id{-1};
     int current_answer_index{0};
+    // Message showing the current question; edited in place on every answer.
+    std::int32_t question_message_id{0};
 };
 
 std::string status_to_string(SessionStatus s);
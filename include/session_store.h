@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -20,11 +21,19 @@ public:
     void mark_anon(std::int64_t chatId);
     void mark_auth(std::int64_t chatId);
 
-    std::vector<std::int64_t> anon_chats();
-    std::vector<std::int64_t> auth_chats();
+    enum class ChatSet { ANON, AUTH };
+    // One SSCAN page of the set: `*cursor` starts at "0" and is "0" again
+    // after the last page. A chat may show up on more than one page.
+    std::vector<std::int64_t> scan_chats(ChatSet set, std::string* cursor, std::size_t count);
+    // The sessions of `chatIds`, in order, fetched with a single MGET; empty
+    // if Redis could not be reached.
+    std::vector<Session> load_many(const std::vector<std::int64_t>& chatIds);
 
     bool ping();
 
+    const std::shared_ptr<RedisClient>& redis() const { return redis_; }
+    const std::string& prefix() const { return prefix_; }
+
 private:
     std::shared_ptr<RedisClient> redis_;
     std::string prefix_;
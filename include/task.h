@@ -0,0 +1,113 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Minimal lazily-started coroutine task. `co_await task` starts it and resumes
+// the awaiting coroutine (via symmetric transfer) once it finishes; exceptions
+// are rethrown at the co_await. Use spawn() to run a top-level Task<void>.
+
+template <typename T = void>
+class Task;
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation{std::noop_coroutine()};
+    std::exception_ptr error;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    template <typename U>
+    void return_value(U&& v) {
+        value.emplace(std::forward<U>(v));
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+};
+
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) noexcept : h_(h) {}
+    Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task& operator=(Task&&) = delete;
+    ~Task() {
+        if (h_) h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    T await_resume() {
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+        if constexpr (!std::is_void_v<T>) return std::move(*h_.promise().value);
+    }
+
+private:
+    Handle h_;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// Fire-and-forget coroutine: starts immediately and frees its frame when done.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            try {
+                throw;
+            } catch (const std::exception& e) {
+                std::cerr << "detached task failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "detached task failed" << std::endl;
+            }
+        }
+    };
+};
+
+// Runs `t` on the calling thread up to its first suspension; it continues on
+// whichever thread resumes it.
+inline Detached spawn(Task<void> t) {
+    co_await t;
+}
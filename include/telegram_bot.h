@@ -1,17 +1,37 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <stop_token>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <tgbot/tgbot.h>
 
+#include "answer_log.h"
 #include "auth_client.h"
+#include "callback_data.h"
+#include "cluster_membership.h"
+#include "dispatcher.h"
+#include "idempotency_set.h"
+#include "io_pool.h"
+#include "json_stream.h"
+#include "keyboard_cache.h"
 #include "main_client.h"
+#include "metrics.h"
+#include "outbox_store.h"
+#include "rate_limiter.h"
+#include "request_executor.h"
 #include "session_store.h"
+#include "task.h"
 
 class TelegramModuleBot {
 public:
@@ -19,32 +39,190 @@ public:
                       std::shared_ptr<SessionStore> store,
                       AuthClient auth,
                       MainClient main);
+    // Talks to the Bot API through `http` (which must outlive the bot) instead of
+    // tgbot-cpp's default client; used by the offline load-test harness.
+    TelegramModuleBot(std::string token,
+                      std::shared_ptr<SessionStore> store,
+                      AuthClient auth,
+                      MainClient main,
+                      const TgBot::HttpClient& http);
 
+    // Startup phase, before run(): probes Redis, auth, main and the Bot API in
+    // parallel and opens the Redis connection pool. Only Redis is required;
+    // returns false if it is unreachable.
+    bool warm_up();
+    // Polls for updates until request_stop(), then drains: in-flight handlers and
+    // queued sends get until TG_DRAIN_TIMEOUT_SEC (25) after the stop request to
+    // finish before the background threads are joined and the cluster lease is
+    // dropped.
     void run();
+    // Safe to call from any thread (e.g. a signal watcher).
+    void request_stop();
+    // Runs the registered handlers for one update. Before run() has started the
+    // worker pool, everything executes on the calling thread.
+    void process_update(const TgBot::Update::Ptr& update);
 
 private:
     TgBot::Bot bot_;
     std::shared_ptr<SessionStore> store_;
     AuthClient auth_;
     MainClient main_;
+    RequestExecutor requests_;
     std::mutex send_mtx_;
 
-    void safe_send(std::int64_t chatId, const std::string& text, TgBot::InlineKeyboardMarkup::Ptr kb = nullptr);
+    using CallbackHandler = void (TelegramModuleBot::*)(std::int64_t, std::int32_t, Session&, const CallbackData&);
+    using AsyncCallbackHandler =
+        Task<void> (TelegramModuleBot::*)(std::int64_t, std::int32_t, Session&, const CallbackData&);
+    struct CallbackRoute {
+        CallbackHandler fn{nullptr};
+        AsyncCallbackHandler async_fn{nullptr};
+        const char* name{nullptr};
+        RateLimiter::Class rate_class{RateLimiter::Class::UNKNOWN};
+        Counter* calls{nullptr};
+        Histogram* latency{nullptr};
+
+        bool bound() const { return fn || async_fn; }
+    };
+    std::array<CallbackRoute, 128> callback_routes_{};
+
+    // One rendered /users page; cached per chat and offset for a short TTL so
+    // paging back and forth does not refetch.
+    struct UsersPage {
+        int http{200};
+        std::string text;
+        int prev_offset{-1};
+        int next_offset{-1};
+        // Id of the first user in the response, to spot a backend ignoring offset.
+        long long first_id{-1};
+        std::chrono::steady_clock::time_point fetched;
+    };
+    std::mutex users_pages_mtx_;
+    std::unordered_map<std::string, UsersPage> users_pages_;
+
+    // Course, test and navigation keyboards shared between renders.
+    KeyboardCache keyboards_;
+
+    // Callback query ids and per-question answer taps already handled.
+    IdempotencySet seen_callbacks_;
+    // Per-chat and global admission, checked before an update is dispatched.
+    RateLimiter limiter_;
+    // Which chats this replica sweeps when several run against one Redis.
+    ClusterMembership cluster_;
+    // Notifications waiting for delivery; drained by the outbox thread.
+    OutboxStore outbox_;
+
+    // Batched-answer mode (TG_BATCH_ANSWERS): taps are logged in answer_log_ and
+    // reach the backend TG_ANSWER_BATCH (10) at a time, and in full before the
+    // attempt is finished.
+    const bool batch_answers_;
+    const long long answer_batch_;
+    AnswerLog answer_log_;
+    // (answer id, question id) per position of a chat's current attempt, so a
+    // batched tap moves on without re-reading the attempt's answer list. Kept
+    // most recently used first; dropped when the attempt finishes or evicted.
+    struct AttemptPlan {
+        int attempt_id{-1};
+        std::vector<std::pair<int, int>> answers;
+    };
+    using PlanList = std::list<std::pair<std::int64_t, AttemptPlan>>;
+    std::mutex plans_mtx_;
+    PlanList plans_lru_;
+    std::unordered_map<std::int64_t, PlanList::iterator> plans_;
+
+    std::stop_source stop_;
+    const std::chrono::seconds drain_timeout_;
+    // Set by the first request_stop(), before stop_ is signalled.
+    std::chrono::steady_clock::time_point drain_deadline_{};
+    std::vector<std::thread> background_;
+    // Declared last so their threads are joined before the members they use go
+    // away; the io pool goes first since its threads resume dispatcher chains.
+    Dispatcher dispatcher_;
+    IoPool io_;
+
+    // Returns the sent message id, or 0 if the call failed. `undeliverable` is
+    // set when Telegram refused the message for good (bot blocked, bad request)
+    // rather than failing transiently.
+    std::int32_t safe_send(std::int64_t chatId,
+                           const std::string& text,
+                           TgBot::InlineKeyboardMarkup::Ptr kb = nullptr,
+                           bool* undeliverable = nullptr);
+    // Returns false if the message could not be edited (deleted, too old, ...).
+    bool safe_edit(std::int64_t chatId,
+                   std::int32_t messageId,
+                   const std::string& text,
+                   TgBot::InlineKeyboardMarkup::Ptr kb = nullptr);
 
     bool ensure_auth(std::int64_t chatId, Session& s);
-    bool refresh_if_needed(Session& s);
+    // Fills user_id/role for sessions saved before they were tracked; false
+    // (after telling the chat) if the backend could not say who this is.
+    bool ensure_identity(std::int64_t chatId, Session& s);
+    // Refuses admin-only commands locally when the cached role is known and not
+    // one of TG_ADMIN_ROLES ("admin"); otherwise the backend decides.
+    bool ensure_admin(std::int64_t chatId, Session& s);
+    // GETs a JSON array endpoint through `parser` (reset before any replay).
+    cpr::Response get_array(std::int64_t chatId, Session& s, const std::string& path, JsonArrayStream& parser);
+
+    // The upstream a command depends on, or nullptr if it needs none.
+    const CircuitBreaker* breaker_for(const std::string& command) const;
+    // Sends a fixed notice from the I/O pool rather than the calling thread.
+    void notify(std::int64_t chatId, const char* text);
+    // Answers a callback query (with an optional notice) from the I/O pool.
+    void acknowledge(const std::string& queryId, const char* text);
+    // Replies "try again later" and returns true if `breaker` is open.
+    bool shed(std::int64_t chatId, const CircuitBreaker* breaker);
+    // Runs the in-process limits; the first refusal in a row tells the chat to slow down.
+    bool admitted(std::int64_t chatId, RateLimiter::Class c);
 
     void setup_handlers();
-    TgBot::InlineKeyboardMarkup::Ptr make_kb(
-        const std::vector<std::pair<std::string, std::string>>& buttons);
+    void on_command(const std::string& name, std::function<void(TgBot::Message::Ptr)> fn);
+    void on_command_async(const std::string& name, std::function<Task<void>(TgBot::Message::Ptr)> fn);
+    void setup_callback_handlers();
 
-    void show_courses(std::int64_t chatId, Session& s);
-    void show_course_tests(std::int64_t chatId, Session& s);
+    // Awaitable wrappers that run the blocking calls on io_.
+    Task<std::int32_t> send_async(std::int64_t chatId,
+                                  std::string text,
+                                  TgBot::InlineKeyboardMarkup::Ptr kb = nullptr);
+    // Loads the session and runs ensure_auth; false if the chat is not logged in.
+    Task<bool> load_authed(std::int64_t chatId, Session& s);
+    Task<MainClient::JsonGet> main_get_async(std::int64_t chatId, Session& s, std::string path);
+
+    UsersPage users_page(std::int64_t chatId, Session& s, int offset);
+    void show_users_page(std::int64_t chatId, std::int32_t messageId, Session& s, int offset);
+
+    Task<void> show_courses(std::int64_t chatId, Session& s);
+    Task<void> show_course_tests(std::int64_t chatId, Session& s);
     void start_attempt(std::int64_t chatId, Session& s);
+    // The plan of the session's current attempt, read from the backend unless
+    // cached. Returns the HTTP status (200 on success), or -1 if the answer
+    // list could not be parsed.
+    int attempt_plan(std::int64_t chatId, Session& s, AttemptPlan* out);
+    void forget_plan(std::int64_t chatId);
     void show_current_question(std::int64_t chatId, Session& s);
-    void handle_answer(std::int64_t chatId, Session& s, const std::string& data);
+    // Edits the session's question message in place, sending a new one only if
+    // there is none yet or the edit fails.
+    void render_question(std::int64_t chatId,
+                         Session& s,
+                         const std::string& text,
+                         TgBot::InlineKeyboardMarkup::Ptr kb);
+    void handle_answer(std::int64_t chatId, Session& s, int answer_id, int value);
+    // Sends the attempt's logged answers in tap order; false if some could not
+    // be delivered yet (backend or Redis unavailable) and are still logged.
+    bool flush_answers(std::int64_t chatId, Session& s, int attemptId);
     void finish_attempt(std::int64_t chatId, Session& s);
 
+    Task<void> on_course_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+    void on_test_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+    void on_answer_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+    void on_finish_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+    Task<void> on_back_courses_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+    void on_users_page_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d);
+
+    void shutdown();
     void start_auth_poll_thread();
     void start_notification_thread();
+    void start_outbox_thread();
+    void start_answer_flush_thread();
+    // Runs `work` for each chat on that chat's dispatcher chain, so it is
+    // ordered with the chat's own updates, and returns once all have run.
+    void sweep_page(const std::vector<std::int64_t>& chats, const std::function<void(std::int64_t)>& work);
 };
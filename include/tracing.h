@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Per-update tracing written as JSON lines (one span per line, OTLP-like field names).
+// A TraceScope starts a sampled trace on the current thread; Span records a child of
+// whatever span is currently open on that thread and is a no-op when nothing is sampled.
+
+class Tracer {
+public:
+    static Tracer& instance();
+
+    // Call once at startup, before any update is handled. Empty path disables
+    // tracing; sample_rate is clamped to [0, 1].
+    bool configure(const std::string& path, double sample_rate);
+    bool enabled() const { return file_ != nullptr; }
+
+private:
+    friend class TraceScope;
+
+    std::mutex mtx_;
+    std::FILE* file_{nullptr};
+    double sample_rate_{0.0};
+
+    bool should_sample() const;
+    void write(const std::string& lines);
+};
+
+struct ActiveTrace;
+
+class TraceScope {
+public:
+    TraceScope(const char* name, std::int64_t chat_id);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    std::unique_ptr<ActiveTrace> trace_;
+    std::size_t span_{0};
+    bool nested_{false};
+};
+
+// Moves the calling thread's open trace to another thread: detach it before a
+// coroutine suspends, adopt it on the thread that resumes the coroutine.
+ActiveTrace* detach_trace();
+
+class AdoptTrace {
+public:
+    explicit AdoptTrace(ActiveTrace* trace);
+    ~AdoptTrace();
+
+    AdoptTrace(const AdoptTrace&) = delete;
+    AdoptTrace& operator=(const AdoptTrace&) = delete;
+
+private:
+    ActiveTrace* prev_;
+};
+
+class Span {
+public:
+    explicit Span(const char* name, std::string_view detail = {});
+    ~Span();
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    std::size_t idx_{0};
+    bool active_{false};
+};
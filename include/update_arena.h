@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+
+// Scratch memory for one update. The handler wrappers open an UpdateArena for
+// the whole run of an update; code on that path builds its short-lived strings
+// and vectors on scratch() instead of the heap, and all of it is dropped at
+// once when the arena closes. Like the open trace, the arena is thread-local
+// and follows the coroutine across IoPool hops (detach_arena / AdoptArena).
+//
+// Nothing allocated from scratch() may outlive the handler: copy results into
+// std::string before storing or sending them.
+//
+// Each arena starts on a recycled block of TG_ARENA_BYTES (16384); anything
+// beyond it comes from the heap and is counted in tg_update_arena_overflows_total.
+class UpdateArena : public std::pmr::memory_resource {
+public:
+    UpdateArena();
+    ~UpdateArena() override;
+
+    UpdateArena(const UpdateArena&) = delete;
+    UpdateArena& operator=(const UpdateArena&) = delete;
+
+    std::size_t used() const { return used_; }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size{0};
+    };
+
+    // Counts what the monotonic resource has to take from the heap.
+    class Overflow : public std::pmr::memory_resource {
+    public:
+        std::size_t calls{0};
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t align) override;
+        void do_deallocate(void* p, std::size_t bytes, std::size_t align) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+    };
+
+    bool nested_{false};
+    Block block_;
+    Overflow overflow_;
+    std::optional<std::pmr::monotonic_buffer_resource> mono_;
+    std::size_t used_{0};
+
+    void* do_allocate(std::size_t bytes, std::size_t align) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+// The current update's arena, or the heap when no update is running here.
+std::pmr::memory_resource* scratch();
+
+// Hands the calling thread's arena to the thread that resumes the coroutine.
+UpdateArena* detach_arena();
+
+class AdoptArena {
+public:
+    explicit AdoptArena(UpdateArena* arena);
+    ~AdoptArena();
+
+    AdoptArena(const AdoptArena&) = delete;
+    AdoptArena& operator=(const AdoptArena&) = delete;
+
+private:
+    UpdateArena* prev_;
+};
+
+// Decimal digits of `v` appended without a temporary std::string.
+void append_int(std::pmr::string& out, long long v);
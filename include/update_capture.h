@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include <tgbot/tgbot.h>
+
+// Opt-in recording of incoming updates as JSON lines, for replaying real
+// traffic offline (tg_replay). Each line is a Bot API shaped update cut down
+// to the fields the handlers read, plus "at_ms", the time since capture
+// started:
+//
+//   {"at_ms":12,"update_id":3,"message":{"message_id":5,"chat":{"id":42},"text":"/courses"}}
+//   {"at_ms":40,"update_id":4,"callback_query":{"id":"9","data":"...","message":{...}}}
+//
+// The file holds message text as typed, so it is only written when
+// TG_CAPTURE_FILE is set.
+class UpdateCapture {
+public:
+    static UpdateCapture& instance();
+
+    // Call once at startup, before any update is handled; empty path disables.
+    bool configure(const std::string& path);
+    bool enabled() const { return file_ != nullptr; }
+
+    void message(const TgBot::Message::Ptr& m);
+    void callback(const TgBot::CallbackQuery::Ptr& q);
+
+    // One captured line back as an update; nullptr if it cannot be read.
+    static TgBot::Update::Ptr parse(const std::string& line, std::int64_t* at_ms);
+
+private:
+    std::mutex mtx_;
+    std::FILE* file_{nullptr};
+    std::chrono::steady_clock::time_point started_;
+    std::int32_t next_id_{1};
+
+    void write(const std::string& kind, const std::string& body);
+};
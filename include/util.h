@@ -1,13 +1,95 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <string>
+#include <stop_token>
+#include <string_view>
 #include <vector>
 
 std::string getenv_or(const char* key, const std::string& def);
 std::string random_token(std::size_t len = 32);
 
+// Sleeps for `d` unless a stop is requested first; false if it was.
+bool sleep_unless_stopped(std::stop_token stop, std::chrono::milliseconds d);
+
 std::string trim(const std::string& s);
 bool starts_with(const std::string& s, const std::string& prefix);
 std::vector<std::string> split_ws(const std::string& s);
 std::vector<std::string> split_by(const std::string& s, char delim);
+
+// Splits a multi-line message into pieces of at most `max` bytes, breaking only
+// between lines. A message that already fits is returned as a single piece.
+std::vector<std::string> chunk_message(const std::string& msg, std::size_t max);
+
+// --- Non-owning tokenizer ---
+// Views returned by these helpers point into the input; the caller keeps it alive.
+
+// Index of the first `c` (or first isspace() byte) at or after `from`, npos if none.
+// Uses an AVX2/SSE2 scan when the target supports it.
+std::size_t find_byte(std::string_view s, char c, std::size_t from = 0);
+std::size_t find_space(std::string_view s, std::size_t from = 0);
+
+std::string_view trim_view(std::string_view s);
+std::string_view command_payload(std::string_view text);
+
+bool parse_int(std::string_view s, int* out);
+bool parse_int(std::string_view s, long long* out);
+bool parse_bool_flag(std::string_view s, bool* out);
+
+// Iterates over delimiter-separated fields, same semantics as split_by().
+class FieldSplitter {
+public:
+    FieldSplitter(std::string_view s, char delim) : s_(s), delim_(delim) {}
+    bool next(std::string_view& field);
+
+private:
+    std::string_view s_;
+    char delim_;
+    std::size_t pos_{0};
+    bool done_{false};
+};
+
+// Iterates over whitespace-separated words, same semantics as split_ws().
+class WordSplitter {
+public:
+    explicit WordSplitter(std::string_view s) : s_(s) {}
+    bool next(std::string_view& word);
+
+private:
+    std::string_view s_;
+    std::size_t pos_{0};
+};
+
+// First N fields plus the total count (which may exceed N).
+template <std::size_t N>
+struct Fields {
+    std::array<std::string_view, N> v{};
+    std::size_t count{0};
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::string_view operator[](std::size_t i) const { return i < N ? v[i] : std::string_view{}; }
+};
+
+template <std::size_t N, typename Splitter>
+Fields<N> collect_fields(Splitter sp) {
+    Fields<N> f;
+    std::string_view part;
+    while (sp.next(part)) {
+        if (f.count < N) f.v[f.count] = part;
+        f.count++;
+    }
+    return f;
+}
+
+template <std::size_t N>
+Fields<N> split_by_view(std::string_view s, char delim) {
+    return collect_fields<N>(FieldSplitter(s, delim));
+}
+
+template <std::size_t N>
+Fields<N> split_ws_view(std::string_view s) {
+    return collect_fields<N>(WordSplitter(s));
+}
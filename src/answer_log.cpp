@@ -0,0 +1,80 @@
+#include "answer_log.h"
+
+#include <string_view>
+#include <utility>
+
+#include "util.h"
+
+namespace {
+
+// Lists outlive an abandoned attempt by as long as a session does.
+constexpr int kTtlSeconds = 60 * 60 * 24 * 7;
+
+// Drops the index entry only if the list is really empty; another replica may
+// have appended to it since this one read it.
+const char* const kForgetIfEmpty =
+    "if redis.call('LLEN', KEYS[1]) == 0 then return redis.call('SREM', KEYS[2], ARGV[1]) end return 0";
+
+} // namespace
+
+AnswerLog::AnswerLog(std::shared_ptr<RedisClient> redis, const std::string& prefix)
+    : redis_(std::move(redis)), prefix_(prefix + ":answers:"), index_(prefix + ":answers") {}
+
+std::string AnswerLog::key(std::int64_t chatId, int attemptId) const { return prefix_ + member(chatId, attemptId); }
+
+std::string AnswerLog::member(std::int64_t chatId, int attemptId) {
+    return std::to_string(chatId) + ":" + std::to_string(attemptId);
+}
+
+long long AnswerLog::append(std::int64_t chatId, int attemptId, int answerId, int value) {
+    const std::string k = key(chatId, attemptId);
+    const long long n = redis_->rpush(k, std::to_string(answerId) + ":" + std::to_string(value));
+    if (n == 0) return 0;
+    if (n == 1) {
+        redis_->sadd(index_, member(chatId, attemptId));
+        redis_->expire(k, kTtlSeconds);
+    }
+    return n;
+}
+
+std::optional<std::vector<AnswerLog::Pending>> AnswerLog::pending(std::int64_t chatId, int attemptId) {
+    auto raw = redis_->lrange(key(chatId, attemptId), 0, -1);
+    if (!raw) return std::nullopt;
+    std::vector<Pending> out;
+    out.reserve(raw->size());
+    for (const auto& e : *raw) {
+        auto f = split_by_view<2>(e, ':');
+        Pending p;
+        if (f.size() == 2 && parse_int(f[0], &p.answer_id) && parse_int(f[1], &p.value)) out.push_back(p);
+    }
+    return out;
+}
+
+bool AnswerLog::drop(std::int64_t chatId, int attemptId, std::size_t n, std::size_t total) {
+    const std::string k = key(chatId, attemptId);
+    // Trimmed rather than deleted even when everything was sent: entries
+    // appended after pending() read the list stay behind.
+    if (n > 0 && !redis_->ltrim(k, static_cast<long long>(n), -1)) return false;
+    if (n < total) return true;
+    return redis_->eval_int(kForgetIfEmpty, {k, index_}, {member(chatId, attemptId)}).has_value();
+}
+
+void AnswerLog::discard(std::int64_t chatId, int attemptId) {
+    const std::string k = key(chatId, attemptId);
+    redis_->del(k);
+    redis_->eval_int(kForgetIfEmpty, {k, index_}, {member(chatId, attemptId)});
+}
+
+std::vector<AnswerLog::Attempt> AnswerLog::scan(std::string* cursor, std::size_t count) {
+    std::vector<Attempt> out;
+    for (const auto& m : redis_->sscan(index_, cursor, count)) {
+        auto f = split_by_view<2>(m, ':');
+        long long chatId = 0;
+        Attempt a;
+        if (f.size() == 2 && parse_int(f[0], &chatId) && parse_int(f[1], &a.attempt_id)) {
+            a.chat_id = chatId;
+            out.push_back(a);
+        }
+    }
+    return out;
+}
@@ -3,14 +3,59 @@
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <utility>
 
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "util.h"
+
 using json = nlohmann::json;
 
-AuthClient::AuthClient(std::string base) : base_(std::move(base)) {}
+namespace {
+
+Histogram& op_latency(const std::string& op) {
+    return MetricsRegistry::instance().histogram(
+        "tg_auth_request_seconds", "Auth service request time, by operation", metric_label("op", op));
+}
+
+// Runs `call` unless the breaker is open, in which case the result is an
+// empty status-0 response.
+template <typename F>
+cpr::Response guarded(CircuitBreaker& breaker, F&& call) {
+    if (!breaker.allow()) return cpr::Response{};
+    const auto started = std::chrono::steady_clock::now();
+    auto r = call();
+    breaker.record(r.status_code != 0 && r.status_code < 500, std::chrono::steady_clock::now() - started);
+    return r;
+}
+
+} // namespace
+
+AuthClient::AuthClient(std::string base)
+    : base_(std::move(base)),
+      timeout_ms_(std::stoi(getenv_or("TG_AUTH_TIMEOUT_MS", "5000"))),
+      connect_timeout_ms_(std::stoi(getenv_or("TG_HTTP_CONNECT_TIMEOUT_MS", "1000"))),
+      breaker_(std::make_shared<CircuitBreaker>("auth")) {}
+
+bool AuthClient::reachable(std::int32_t timeout_ms) const {
+    auto r = cpr::Get(cpr::Url{base_ + "/"}, cpr::Timeout{timeout_ms}, cpr::ConnectTimeout{std::min(timeout_ms, connect_timeout_ms_)});
+    return r.status_code != 0 && r.status_code < 500;
+}
 
 AuthClient::LoginStartResult AuthClient::start_login(const std::string& type, const std::string& token_in) {
-    auto r = cpr::Get(cpr::Url{base_ + "/auth/login"}, cpr::Parameters{{"type", type}, {"token_in", token_in}});
+    static Histogram& latency = op_latency("login");
+    ScopedTimer timer(latency);
+    Span span("auth.login");
+    FlightPhase phase(FlightRecorder::Phase::AUTH);
+    auto r = guarded(*breaker_, [&] {
+        return cpr::Get(cpr::Url{base_ + "/auth/login"},
+                        cpr::Parameters{{"type", type}, {"token_in", token_in}},
+                        cpr::Timeout{timeout_ms_},
+                        cpr::ConnectTimeout{connect_timeout_ms_});
+    });
     if (r.status_code != 200) {
         return {.kind = LoginStartResult::Kind::ERROR,
                 .error = "auth/login failed: HTTP " + std::to_string(r.status_code)};
@@ -26,7 +71,16 @@ AuthClient::LoginStartResult AuthClient::start_login(const std::string& type, co
 }
 
 AuthClient::CheckResult AuthClient::check(const std::string& token_in) {
-    auto r = cpr::Get(cpr::Url{base_ + "/auth/check"}, cpr::Parameters{{"token_in", token_in}});
+    static Histogram& latency = op_latency("check");
+    ScopedTimer timer(latency);
+    Span span("auth.check");
+    FlightPhase phase(FlightRecorder::Phase::AUTH);
+    auto r = guarded(*breaker_, [&] {
+        return cpr::Get(cpr::Url{base_ + "/auth/check"},
+                        cpr::Parameters{{"token_in", token_in}},
+                        cpr::Timeout{timeout_ms_},
+                        cpr::ConnectTimeout{connect_timeout_ms_});
+    });
     CheckResult out;
     out.http = r.status_code;
     try {
@@ -41,10 +95,17 @@ AuthClient::CheckResult AuthClient::check(const std::string& token_in) {
 }
 
 std::optional<std::pair<std::string, std::string>> AuthClient::refresh(const std::string& refresh_token) {
-    auto r = cpr::Post(
-        cpr::Url{base_ + "/auth/refresh"},
-        cpr::Header{{"Content-Type", "application/json"}},
-        cpr::Body{json{{"refresh_token", refresh_token}}.dump()});
+    static Histogram& latency = op_latency("refresh");
+    ScopedTimer timer(latency);
+    Span span("auth.refresh");
+    FlightPhase phase(FlightRecorder::Phase::AUTH);
+    auto r = guarded(*breaker_, [&] {
+        return cpr::Post(cpr::Url{base_ + "/auth/refresh"},
+                         cpr::Header{{"Content-Type", "application/json"}},
+                         cpr::Body{json{{"refresh_token", refresh_token}}.dump()},
+                         cpr::Timeout{timeout_ms_},
+                         cpr::ConnectTimeout{connect_timeout_ms_});
+    });
 
     if (r.status_code != 200) return std::nullopt;
 
@@ -57,8 +118,15 @@ std::optional<std::pair<std::string, std::string>> AuthClient::refresh(const std
 }
 
 bool AuthClient::logout(const std::string& refresh_token, bool all) {
-    auto r = cpr::Post(
-        cpr::Url{base_ + "/auth/logout"},
-        cpr::Parameters{{"refresh_token", refresh_token}, {"all", all ? "true" : "false"}});
+    static Histogram& latency = op_latency("logout");
+    ScopedTimer timer(latency);
+    Span span("auth.logout");
+    FlightPhase phase(FlightRecorder::Phase::AUTH);
+    auto r = guarded(*breaker_, [&] {
+        return cpr::Post(cpr::Url{base_ + "/auth/logout"},
+                         cpr::Parameters{{"refresh_token", refresh_token}, {"all", all ? "true" : "false"}},
+                         cpr::Timeout{timeout_ms_},
+                         cpr::ConnectTimeout{connect_timeout_ms_});
+    });
     return r.status_code == 200;
 }
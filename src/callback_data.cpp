@@ -0,0 +1,101 @@
+#include "callback_data.h"
+
+#include <charconv>
+#include <system_error>
+
+namespace {
+
+int arity(CallbackAction a) {
+    switch (a) {
+        case CallbackAction::COURSE: return 1;
+        case CallbackAction::TEST: return 1;
+        case CallbackAction::ANSWER: return 2;
+        case CallbackAction::FINISH: return 1;
+        case CallbackAction::BACK_COURSES: return 0;
+        case CallbackAction::USERS_PAGE: return 1;
+        case CallbackAction::NONE: break;
+    }
+    return -1;
+}
+
+bool parse_arg(std::string_view s, int* out) {
+    if (s.empty()) return false;
+    int v = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc{} || ptr != s.data() + s.size() || v < 0) return false;
+    *out = v;
+    return true;
+}
+
+bool parse_args(std::string_view rest, CallbackAction action, CallbackData* out) {
+    const int n = arity(action);
+    if (n < 0) return false;
+
+    CallbackData d;
+    d.action = action;
+    if (n == 0) {
+        if (!rest.empty()) return false;
+    } else if (n == 1) {
+        if (!parse_arg(rest, &d.arg0)) return false;
+    } else {
+        auto sep = rest.find(':');
+        if (sep == std::string_view::npos) return false;
+        if (!parse_arg(rest.substr(0, sep), &d.arg0)) return false;
+        if (!parse_arg(rest.substr(sep + 1), &d.arg1)) return false;
+    }
+    *out = d;
+    return true;
+}
+
+struct LegacyPrefix {
+    std::string_view prefix;
+    CallbackAction action;
+};
+
+constexpr LegacyPrefix kLegacy[] = {
+    {"course:", CallbackAction::COURSE},
+    {"test:", CallbackAction::TEST},
+    {"ans:", CallbackAction::ANSWER},
+    {"finish:", CallbackAction::FINISH},
+};
+
+bool decode_legacy(std::string_view data, CallbackData* out) {
+    if (data == "back:courses") {
+        *out = CallbackData{CallbackAction::BACK_COURSES, 0, 0};
+        return true;
+    }
+    for (const auto& l : kLegacy) {
+        if (data.substr(0, l.prefix.size()) == l.prefix) {
+            return parse_args(data.substr(l.prefix.size()), l.action, out);
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+std::string encode_callback(CallbackAction action, int arg0, int arg1) {
+    // 1 action byte + 2 * (10 digits) + separator fits well under Telegram's 64-byte limit.
+    char buf[32];
+    char* p = buf;
+    char* end = buf + sizeof(buf);
+    *p++ = static_cast<char>(action);
+    const int n = arity(action);
+    if (n >= 1) p = std::to_chars(p, end, arg0).ptr;
+    if (n >= 2 && p < end) {
+        *p++ = ':';
+        p = std::to_chars(p, end, arg1).ptr;
+    }
+    return std::string(buf, static_cast<std::size_t>(p - buf));
+}
+
+bool decode_callback(std::string_view data, CallbackData* out) {
+    if (data.empty() || data.size() > 64) return false;
+
+    // Compact payloads carry a digit (or nothing) right after the action byte;
+    // anything else is a legacy word prefix.
+    if (data.size() == 1 || (data[1] >= '0' && data[1] <= '9')) {
+        return parse_args(data.substr(1), static_cast<CallbackAction>(data[0]), out);
+    }
+    return decode_legacy(data, out);
+}
@@ -0,0 +1,140 @@
+#include "circuit_breaker.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "metrics.h"
+#include "util.h"
+
+namespace {
+
+const char* state_name(CircuitBreaker::State s) {
+    switch (s) {
+        case CircuitBreaker::State::CLOSED: return "closed";
+        case CircuitBreaker::State::HALF_OPEN: return "half-open";
+        case CircuitBreaker::State::OPEN: return "open";
+    }
+    return "?";
+}
+
+} // namespace
+
+CircuitBreaker::Options CircuitBreaker::Options::from_env() {
+    Options o;
+    o.window = static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_CB_WINDOW", "20"))));
+    o.min_calls = static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_CB_MIN_CALLS", "10"))));
+    o.error_rate = std::stod(getenv_or("TG_CB_ERROR_RATE", "0.5"));
+    o.slow = std::chrono::milliseconds(std::stoi(getenv_or("TG_CB_SLOW_MS", "3000")));
+    o.slow_rate = std::stod(getenv_or("TG_CB_SLOW_RATE", "0.8"));
+    o.open_for = std::chrono::milliseconds(std::stoi(getenv_or("TG_CB_OPEN_MS", "10000")));
+    return o;
+}
+
+CircuitBreaker::CircuitBreaker(std::string upstream, Options opts)
+    : upstream_(std::move(upstream)),
+      opts_(opts),
+      state_gauge_(MetricsRegistry::instance().gauge(
+          "tg_circuit_state", "Circuit breaker state (0 closed, 1 half-open, 2 open), by upstream",
+          metric_label("upstream", upstream_))),
+      opened_(MetricsRegistry::instance().counter(
+          "tg_circuit_opened_total", "Times the circuit breaker opened, by upstream", metric_label("upstream", upstream_))),
+      rejected_(MetricsRegistry::instance().counter(
+          "tg_circuit_rejected_total", "Calls failed fast by an open circuit breaker, by upstream",
+          metric_label("upstream", upstream_))) {
+    ring_.reserve(opts_.window);
+    state_gauge_.set(0);
+}
+
+bool CircuitBreaker::allow() {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (state_ == State::CLOSED) return true;
+    if (state_ == State::OPEN) {
+        if (std::chrono::steady_clock::now() < open_until_) {
+            rejected_.inc();
+            return false;
+        }
+        set_state(State::HALF_OPEN);
+        probe_out_ = false;
+    }
+    if (probe_out_) {
+        rejected_.inc();
+        return false;
+    }
+    probe_out_ = true;
+    return true;
+}
+
+void CircuitBreaker::record(bool ok, std::chrono::steady_clock::duration latency) {
+    const bool slow = latency >= opts_.slow;
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lk(mtx_);
+    switch (state_) {
+        case State::OPEN:
+            // A call admitted before the trip; the breaker has already decided.
+            return;
+        case State::HALF_OPEN:
+            if (!probe_out_) return;
+            probe_out_ = false;
+            if (!ok || slow) {
+                trip(now);
+            } else {
+                reset_window();
+                set_state(State::CLOSED);
+            }
+            return;
+        case State::CLOSED: break;
+    }
+
+    if (ring_.size() < opts_.window) {
+        ring_.push_back({!ok, slow});
+    } else {
+        const Outcome old = ring_[next_];
+        failed_ -= old.failed;
+        slow_ -= old.slow;
+        ring_[next_] = {!ok, slow};
+    }
+    next_ = (next_ + 1) % opts_.window;
+    failed_ += !ok;
+    slow_ += slow;
+
+    const std::size_t n = ring_.size();
+    if (n < opts_.min_calls) return;
+    const double n_d = static_cast<double>(n);
+    if (static_cast<double>(failed_) / n_d >= opts_.error_rate || static_cast<double>(slow_) / n_d >= opts_.slow_rate) {
+        trip(now);
+    }
+}
+
+CircuitBreaker::State CircuitBreaker::state() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return state_;
+}
+
+bool CircuitBreaker::rejecting() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (state_ == State::CLOSED) return false;
+    if (state_ == State::OPEN) return std::chrono::steady_clock::now() < open_until_;
+    return probe_out_;
+}
+
+void CircuitBreaker::trip(std::chrono::steady_clock::time_point now) {
+    open_until_ = now + opts_.open_for;
+    reset_window();
+    if (state_ != State::OPEN) opened_.inc();
+    set_state(State::OPEN);
+}
+
+void CircuitBreaker::reset_window() {
+    ring_.clear();
+    next_ = 0;
+    failed_ = 0;
+    slow_ = 0;
+}
+
+void CircuitBreaker::set_state(State s) {
+    if (s == state_) return;
+    std::cerr << "circuit " << upstream_ << ": " << state_name(state_) << " -> " << state_name(s) << std::endl;
+    state_ = s;
+    state_gauge_.set(static_cast<double>(s));
+}
@@ -0,0 +1,130 @@
+#include "cluster_membership.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+#include "metrics.h"
+#include "util.h"
+
+namespace {
+
+// Stable across processes and builds, unlike std::hash.
+std::uint64_t fnv1a(std::string_view s) {
+    std::uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::string default_instance_id() {
+    char host[256] = {0};
+    if (::gethostname(host, sizeof(host) - 1) != 0) host[0] = '\0';
+    return std::string(host[0] ? host : "bot") + ":" + std::to_string(::getpid());
+}
+
+} // namespace
+
+ClusterMembership::ClusterMembership(std::shared_ptr<RedisClient> redis, const std::string& prefix)
+    : redis_(std::move(redis)),
+      members_key_(prefix + ":members"),
+      member_prefix_(prefix + ":member:"),
+      id_(getenv_or("TG_INSTANCE_ID", default_instance_id())),
+      heartbeat_every_(std::max(1, std::stoi(getenv_or("TG_CLUSTER_HEARTBEAT_SEC", "5")))),
+      ttl_sec_(std::max(2, std::stoi(getenv_or("TG_CLUSTER_TTL_SEC", "15")))),
+      vnodes_(std::max(1, std::stoi(getenv_or("TG_CLUSTER_VNODES", "64")))) {
+    rebuild({id_});
+}
+
+ClusterMembership::~ClusterMembership() { stop(); }
+
+void ClusterMembership::start() {
+    if (thread_.joinable()) return;
+    heartbeat();
+    thread_ = std::jthread([this](std::stop_token stop) {
+        while (sleep_unless_stopped(stop, heartbeat_every_)) heartbeat();
+    });
+}
+
+void ClusterMembership::stop() {
+    if (!thread_.joinable()) return;
+    thread_.request_stop();
+    thread_.join();
+    redis_->del(member_prefix_ + id_);
+    redis_->srem(members_key_, id_);
+}
+
+void ClusterMembership::heartbeat() {
+    static Counter& failures = MetricsRegistry::instance().counter(
+        "tg_cluster_heartbeat_failures_total", "Membership heartbeats that could not reach Redis");
+    // Keep the last known ring when Redis is unreachable rather than claiming every chat.
+    if (!redis_->set(member_prefix_ + id_, "1", ttl_sec_)) {
+        failures.inc();
+        return;
+    }
+    redis_->sadd(members_key_, id_);
+    const auto listed = redis_->smembers(members_key_);
+    if (std::find(listed.begin(), listed.end(), id_) == listed.end()) {
+        failures.inc();
+        return;
+    }
+    std::vector<std::string> live;
+    for (const auto& m : listed) {
+        if (m == id_ || redis_->get(member_prefix_ + m)) {
+            live.push_back(m);
+        } else {
+            redis_->srem(members_key_, m);
+        }
+    }
+    rebuild(std::move(live));
+}
+
+void ClusterMembership::rebuild(std::vector<std::string> live) {
+    static Counter& rebalances =
+        MetricsRegistry::instance().counter("tg_cluster_rebalances_total", "Times the set of live replicas changed");
+    static Gauge& members_gauge = MetricsRegistry::instance().gauge("tg_cluster_members", "Live bot replicas");
+
+    std::sort(live.begin(), live.end());
+    std::vector<std::pair<std::uint64_t, std::string>> ring;
+    ring.reserve(live.size() * static_cast<std::size_t>(vnodes_));
+    for (const auto& m : live) {
+        for (int v = 0; v < vnodes_; ++v) ring.emplace_back(mix(fnv1a(m + "#" + std::to_string(v))), m);
+    }
+    std::sort(ring.begin(), ring.end());
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (live == live_) return;
+    if (!live_.empty()) {
+        rebalances.inc();
+        std::cerr << "cluster: " << live.size() << " live replica(s), this is " << id_ << std::endl;
+    }
+    live_ = std::move(live);
+    ring_ = std::move(ring);
+    members_gauge.set(static_cast<double>(live_.size()));
+}
+
+bool ClusterMembership::owns(std::int64_t chatId) const {
+    const std::uint64_t h = mix(static_cast<std::uint64_t>(chatId));
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (ring_.empty()) return true;
+    auto it = std::lower_bound(ring_.begin(), ring_.end(), h, [](const auto& node, std::uint64_t v) { return node.first < v; });
+    if (it == ring_.end()) it = ring_.begin();
+    return it->second == id_;
+}
+
+std::size_t ClusterMembership::members() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return live_.size();
+}
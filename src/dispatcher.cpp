@@ -0,0 +1,142 @@
+#include "dispatcher.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "metrics.h"
+
+namespace {
+
+void task_failed(const char* what) {
+    static Counter& errors =
+        MetricsRegistry::instance().counter("tg_dispatch_task_errors_total", "Worker tasks that threw");
+    errors.inc();
+    std::cerr << "update handler failed: " << what << std::endl;
+}
+
+void run_task(const std::function<void()>& task) {
+    try {
+        task();
+    } catch (const std::exception& e) {
+        task_failed(e.what());
+    } catch (...) {
+        task_failed("unknown error");
+    }
+}
+
+} // namespace
+
+Dispatcher::~Dispatcher() { stop(); }
+
+bool Dispatcher::drain(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lk(chains_mtx_);
+    return chains_idle_.wait_until(lk, deadline, [this] { return chains_.empty(); });
+}
+
+void Dispatcher::stop() {
+    stop_ = true;
+    for (auto& w : workers_) {
+        std::lock_guard<std::mutex> lk(w->mtx);
+        w->cv.notify_all();
+    }
+    for (auto& w : workers_) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+}
+
+void Dispatcher::start(std::size_t workers) {
+    if (!workers_.empty() || workers == 0) return;
+    for (std::size_t i = 0; i < workers; ++i) workers_.push_back(std::make_unique<Worker>());
+    for (auto& w : workers_) {
+        Worker* raw = w.get();
+        w->thread = std::thread([this, raw]() { run_worker(*raw); });
+    }
+}
+
+void Dispatcher::submit(std::int64_t key, std::function<void()> task) {
+    submit_async(key, [task = std::move(task)]() -> Task<void> {
+        task();
+        co_return;
+    });
+}
+
+void Dispatcher::submit_async(std::int64_t key, std::function<Task<void>()> job) {
+    bool idle = false;
+    {
+        std::lock_guard<std::mutex> lk(chains_mtx_);
+        auto& chain = chains_[key];
+        chain.push_back(std::move(job));
+        idle = chain.size() == 1;
+    }
+    if (idle) start_next(key);
+}
+
+void Dispatcher::start_next(std::int64_t key) {
+    post(key, [this, key]() { spawn(run_chain(key)); });
+}
+
+Task<void> Dispatcher::run_chain(std::int64_t key) {
+    std::function<Task<void>()> job;
+    {
+        std::lock_guard<std::mutex> lk(chains_mtx_);
+        job = chains_[key].front();
+    }
+    try {
+        co_await job();
+    } catch (const std::exception& e) {
+        task_failed(e.what());
+    } catch (...) {
+        task_failed("unknown error");
+    }
+
+    bool more = false;
+    {
+        std::lock_guard<std::mutex> lk(chains_mtx_);
+        auto it = chains_.find(key);
+        it->second.pop_front();
+        more = !it->second.empty();
+        if (!more) chains_.erase(it);
+        if (chains_.empty()) chains_idle_.notify_all();
+    }
+    // Hop back to the key's worker rather than running the next job on whatever
+    // thread finished this one.
+    if (more) start_next(key);
+}
+
+void Dispatcher::post(std::int64_t key, std::function<void()> task) {
+    if (workers_.empty() || stop_) {
+        run_task(task);
+        return;
+    }
+    static Histogram& wait = MetricsRegistry::instance().histogram(
+        "tg_dispatch_queue_seconds", "Time an update waits for its worker");
+    static Gauge& depth = MetricsRegistry::instance().gauge("tg_dispatch_queue_depth", "Updates queued across workers");
+
+    Worker& w = *workers_[static_cast<std::uint64_t>(key) % workers_.size()];
+    const auto queued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lk(w.mtx);
+        w.queue.push_back([task = std::move(task), queued]() {
+            wait.observe(std::chrono::steady_clock::now() - queued);
+            depth.add(-1);
+            run_task(task);
+        });
+    }
+    depth.add(1);
+    w.cv.notify_one();
+}
+
+void Dispatcher::run_worker(Worker& w) {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(w.mtx);
+            w.cv.wait(lk, [&] { return stop_ || !w.queue.empty(); });
+            if (w.queue.empty()) return;
+            task = std::move(w.queue.front());
+            w.queue.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,233 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <utility>
+
+#include "metrics.h"
+#include "util.h"
+
+namespace {
+
+thread_local FlightDraft* t_flight = nullptr;
+
+// Word layout of a record.
+constexpr std::size_t kChat = 0;
+constexpr std::size_t kStart = 1;
+constexpr std::size_t kPhase0 = 2;
+constexpr std::size_t kTotal = kPhase0 + FlightRecorder::kPhases;
+constexpr std::size_t kName = kTotal + 1;
+
+// Fewer completed updates than this in a check window say nothing about p99.
+constexpr std::size_t kMinSamples = 20;
+
+const char* const kPhaseNames[FlightRecorder::kPhases] = {"load_us", "auth_us", "backend_us", "send_us"};
+
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::size_t ring_size() {
+    const long long want = std::max(0, std::stoi(getenv_or("TG_FLIGHT_RECORDS", "4096")));
+    std::size_t n = 1;
+    while (static_cast<long long>(n) < want) n <<= 1;
+    return want == 0 ? 0 : n;
+}
+
+std::int64_t unix_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void append_hex(std::string& out, std::uint64_t v) {
+    static const char* k = "0123456789abcdef";
+    for (int shift = 60; shift >= 0; shift -= 4) out.push_back(k[(v >> shift) & 0xf]);
+}
+
+} // namespace
+
+FlightRecorder& FlightRecorder::instance() {
+    static FlightRecorder r;
+    return r;
+}
+
+FlightRecorder::FlightRecorder()
+    : salt_(std::random_device{}() | (static_cast<std::uint64_t>(std::random_device{}()) << 32)),
+      dir_(getenv_or("TG_FLIGHT_DIR", "/tmp")) {
+    const std::size_t n = ring_size();
+    if (n == 0) return;
+    slots_ = std::make_unique<Slot[]>(n);
+    mask_ = n - 1;
+}
+
+FlightRecorder::~FlightRecorder() { stop(); }
+
+void FlightRecorder::commit(const std::uint64_t (&words)[kWords]) {
+    const std::uint64_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[ticket & mask_];
+    // A writer lapped mid-store by another can leave a torn record; with the
+    // ring this size that takes a full ring of updates finishing meanwhile.
+    slot.seq.store(2 * ticket + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < kWords; ++i) slot.words[i].store(words[i], std::memory_order_relaxed);
+    slot.seq.store(2 * ticket + 2, std::memory_order_release);
+}
+
+std::vector<FlightRecorder::Record> FlightRecorder::snapshot(std::uint64_t from) const {
+    std::vector<Record> out;
+    if (!slots_) return out;
+    const std::uint64_t end = next_.load(std::memory_order_acquire);
+    const std::uint64_t size = mask_ + 1;
+    std::uint64_t begin = end > size ? end - size : 0;
+    begin = std::max(begin, from);
+    out.reserve(static_cast<std::size_t>(end - begin));
+    for (std::uint64_t t = begin; t < end; ++t) {
+        const Slot& slot = slots_[t & mask_];
+        const std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        // Still being written, or already reused by a later update.
+        if (seq != 2 * t + 2) continue;
+        Record r;
+        r.ticket = t;
+        for (std::size_t i = 0; i < kWords; ++i) r.words[i] = slot.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+        out.push_back(r);
+    }
+    return out;
+}
+
+std::string FlightRecorder::dump(const char* reason) {
+    static Counter& failures =
+        MetricsRegistry::instance().counter("tg_flight_dump_failures_total", "Flight recorder dumps that could not be written");
+    const auto records = snapshot(0);
+    const std::string path = dir_ + "/flight-" + std::to_string(unix_ns() / 1000000) + "-" + reason + ".jsonl";
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        failures.inc();
+        return {};
+    }
+    std::string line;
+    for (const auto& r : records) {
+        char name[kNameWords * sizeof(std::uint64_t) + 1] = {0};
+        std::memcpy(name, &r.words[kName], kNameWords * sizeof(std::uint64_t));
+        line = "{\"seq\":" + std::to_string(r.ticket);
+        line += ",\"start_time_unix_nano\":" + std::to_string(r.words[kStart]);
+        line += ",\"chat\":\"";
+        append_hex(line, r.words[kChat]);
+        line += "\",\"command\":\"";
+        // Handler names are plain identifiers; nothing to escape.
+        line += name;
+        line += '"';
+        for (std::size_t p = 0; p < kPhases; ++p) {
+            line += ",\"";
+            line += kPhaseNames[p];
+            line += "\":" + std::to_string(r.words[kPhase0 + p] / 1000);
+        }
+        line += ",\"total_us\":" + std::to_string(r.words[kTotal] / 1000) + "}\n";
+        std::fwrite(line.data(), 1, line.size(), f);
+    }
+    const bool ok = std::fclose(f) == 0;
+    if (!ok) {
+        failures.inc();
+        return {};
+    }
+    MetricsRegistry::instance()
+        .counter("tg_flight_dumps_total", "Flight recorder dumps written, by reason", metric_label("reason", reason))
+        .inc();
+    std::cerr << "flight recorder: " << records.size() << " update(s) written to " << path << std::endl;
+    return path;
+}
+
+void FlightRecorder::start() {
+    if (!slots_ || watcher_.joinable()) return;
+    if (std::stoi(getenv_or("TG_FLIGHT_P99_MS", "2000")) <= 0) return;
+    watcher_ = std::jthread([this](std::stop_token stop) { watch(stop); });
+}
+
+void FlightRecorder::stop() {
+    if (!watcher_.joinable()) return;
+    watcher_.request_stop();
+    watcher_.join();
+}
+
+void FlightRecorder::watch(std::stop_token stop) {
+    const auto threshold = std::chrono::nanoseconds(std::chrono::milliseconds(std::stoi(getenv_or("TG_FLIGHT_P99_MS", "2000"))));
+    const auto every = std::chrono::seconds(std::max(1, std::stoi(getenv_or("TG_FLIGHT_CHECK_SEC", "10"))));
+    const auto cooldown = std::chrono::seconds(std::max(0, std::stoi(getenv_or("TG_FLIGHT_COOLDOWN_SEC", "300"))));
+    std::uint64_t from = next_.load(std::memory_order_relaxed);
+    auto last_dump = std::chrono::steady_clock::time_point{};
+    std::vector<std::uint64_t> totals;
+    while (sleep_unless_stopped(stop, every)) {
+        const auto records = snapshot(from);
+        if (records.empty()) continue;
+        from = records.back().ticket + 1;
+        if (records.size() < kMinSamples) continue;
+        totals.clear();
+        for (const auto& r : records) totals.push_back(r.words[kTotal]);
+        const auto nth = totals.begin() + static_cast<std::ptrdiff_t>((totals.size() * 99) / 100);
+        std::nth_element(totals.begin(), nth, totals.end());
+        if (std::chrono::nanoseconds(*nth) <= threshold) continue;
+        const auto now = std::chrono::steady_clock::now();
+        if (last_dump != std::chrono::steady_clock::time_point{} && now - last_dump < cooldown) continue;
+        last_dump = now;
+        dump("p99");
+    }
+}
+
+FlightScope::FlightScope(const char* command, std::int64_t chat_id) {
+    if (t_flight || !FlightRecorder::instance().enabled()) return;
+    draft_.command = command;
+    draft_.chat_id = chat_id;
+    draft_.start_unix_ns = unix_ns();
+    draft_.started = std::chrono::steady_clock::now();
+    active_ = true;
+    t_flight = &draft_;
+}
+
+FlightScope::~FlightScope() {
+    if (!active_) return;
+    if (t_flight == &draft_) t_flight = nullptr;
+    auto& rec = FlightRecorder::instance();
+    std::uint64_t words[FlightRecorder::kWords] = {};
+    words[kChat] = mix(static_cast<std::uint64_t>(draft_.chat_id) ^ rec.salt_);
+    words[kStart] = static_cast<std::uint64_t>(draft_.start_unix_ns);
+    for (std::size_t p = 0; p < FlightRecorder::kPhases; ++p) words[kPhase0 + p] = draft_.phase_ns[p];
+    words[kTotal] = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - draft_.started).count());
+    // The last byte stays zero so the name reads back terminated.
+    const std::size_t len =
+        std::min(std::strlen(draft_.command), FlightRecorder::kNameWords * sizeof(std::uint64_t) - 1);
+    std::memcpy(&words[kName], draft_.command, len);
+    rec.commit(words);
+}
+
+FlightPhase::FlightPhase(FlightRecorder::Phase phase) {
+    if (!t_flight || t_flight->in_phase) return;
+    draft_ = t_flight;
+    draft_->in_phase = true;
+    phase_ = phase;
+    started_ = std::chrono::steady_clock::now();
+}
+
+FlightPhase::~FlightPhase() {
+    if (!draft_) return;
+    draft_->phase_ns[static_cast<std::size_t>(phase_)] += static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_).count());
+    draft_->in_phase = false;
+}
+
+FlightDraft* detach_flight() {
+    return std::exchange(t_flight, nullptr);
+}
+
+AdoptFlight::AdoptFlight(FlightDraft* draft) : prev_(std::exchange(t_flight, draft)) {}
+
+AdoptFlight::~AdoptFlight() {
+    t_flight = prev_;
+}
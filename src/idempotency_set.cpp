@@ -0,0 +1,27 @@
+#include "idempotency_set.h"
+
+IdempotencySet::IdempotencySet(std::chrono::milliseconds ttl, std::size_t max_entries)
+    : ttl_(ttl), max_entries_(max_entries) {}
+
+bool IdempotencySet::first_seen(const std::string& key) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lk(mtx_);
+    expire(now);
+    if (!keys_.emplace(key, now).second) return false;
+    order_.emplace_back(now, key);
+    return true;
+}
+
+void IdempotencySet::forget(const std::string& key) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    keys_.erase(key);
+}
+
+void IdempotencySet::expire(std::chrono::steady_clock::time_point now) {
+    while (!order_.empty() && (now - order_.front().first >= ttl_ || order_.size() >= max_entries_)) {
+        // Skip entries that were forgotten and later re-added with a newer stamp.
+        auto it = keys_.find(order_.front().second);
+        if (it != keys_.end() && it->second == order_.front().first) keys_.erase(it);
+        order_.pop_front();
+    }
+}
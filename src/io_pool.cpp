@@ -0,0 +1,45 @@
+#include "io_pool.h"
+
+IoPool::~IoPool() { stop(); }
+
+void IoPool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void IoPool::start(std::size_t threads) {
+    if (!threads_.empty()) return;
+    for (std::size_t i = 0; i < threads; ++i) threads_.emplace_back([this]() { loop(); });
+}
+
+void IoPool::post(std::function<void()> fn) {
+    if (!threads_.empty()) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!stop_) {
+            queue_.push_back(std::move(fn));
+            cv_.notify_one();
+            return;
+        }
+    }
+    fn();
+}
+
+void IoPool::loop() {
+    while (true) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            fn = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        fn();
+    }
+}
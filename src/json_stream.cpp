@@ -0,0 +1,118 @@
+#include "json_stream.h"
+
+#include <utility>
+
+namespace {
+
+inline bool is_ws(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+} // namespace
+
+JsonArrayStream::JsonArrayStream(ElementFn on_element, std::size_t max_element)
+    : on_element_(std::move(on_element)), max_element_(max_element) {}
+
+void JsonArrayStream::reset() {
+    state_ = State::START;
+    cur_.clear();
+    depth_ = 0;
+    in_string_ = false;
+    escape_ = false;
+    scalar_ = false;
+    count_ = 0;
+}
+
+bool JsonArrayStream::emit(std::string_view tail) {
+    count_++;
+    bool more;
+    if (cur_.empty()) {
+        // The whole element sits in the current chunk: hand it over without copying.
+        more = on_element_(tail);
+    } else {
+        cur_.append(tail);
+        more = on_element_(cur_);
+        cur_.clear();
+    }
+    state_ = more ? State::BETWEEN : State::STOPPED;
+    return more;
+}
+
+bool JsonArrayStream::feed(std::string_view chunk) {
+    // Start of the current element's bytes within `chunk`; they are copied into cur_
+    // only when the element straddles a chunk boundary.
+    std::size_t seg = 0;
+    for (std::size_t i = 0; i < chunk.size(); ++i) {
+        const char c = chunk[i];
+        switch (state_) {
+            case State::NOT_ARRAY:
+            case State::DONE: return true;
+            case State::ERROR:
+            case State::STOPPED: return false;
+
+            case State::START:
+                if (is_ws(c)) continue;
+                if (c != '[') {
+                    state_ = State::NOT_ARRAY;
+                    return true;
+                }
+                state_ = State::BETWEEN;
+                continue;
+
+            case State::BETWEEN:
+                if (is_ws(c) || c == ',') continue;
+                if (c == ']') {
+                    state_ = State::DONE;
+                    continue;
+                }
+                state_ = State::ELEMENT;
+                seg = i;
+                depth_ = 0;
+                in_string_ = false;
+                escape_ = false;
+                scalar_ = (c != '{' && c != '[' && c != '"');
+                break;
+
+            case State::ELEMENT: break;
+        }
+
+        // Inside an element.
+        if (scalar_) {
+            if (c == ',' || c == ']' || is_ws(c)) {
+                if (!emit(chunk.substr(seg, i - seg))) return false;
+                if (c == ']') state_ = State::DONE;
+            }
+            continue;
+        }
+        if (in_string_) {
+            if (escape_) {
+                escape_ = false;
+            } else if (c == '\\') {
+                escape_ = true;
+            } else if (c == '"') {
+                in_string_ = false;
+            }
+        } else if (c == '"') {
+            in_string_ = true;
+        } else if (c == '{' || c == '[') {
+            depth_++;
+        } else if (c == '}' || c == ']') {
+            depth_--;
+        }
+
+        if (!in_string_ && depth_ == 0) {
+            if (cur_.size() + (i + 1 - seg) > max_element_) {
+                state_ = State::ERROR;
+                return false;
+            }
+            if (!emit(chunk.substr(seg, i + 1 - seg))) return false;
+        }
+    }
+
+    if (state_ == State::ELEMENT) {
+        cur_.append(chunk.substr(seg));
+        if (cur_.size() > max_element_) {
+            state_ = State::ERROR;
+            return false;
+        }
+    }
+    return state_ != State::ERROR && state_ != State::STOPPED;
+}
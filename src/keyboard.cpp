@@ -0,0 +1,27 @@
+#include "keyboard.h"
+
+TgBot::InlineKeyboardMarkup::Ptr make_kb(const std::vector<std::pair<std::string, std::string>>& buttons) {
+    auto kb = TgBot::InlineKeyboardMarkup::Ptr(new TgBot::InlineKeyboardMarkup);
+    for (const auto& [text, data] : buttons) {
+        std::vector<TgBot::InlineKeyboardButton::Ptr> row;
+        auto b = TgBot::InlineKeyboardButton::Ptr(new TgBot::InlineKeyboardButton);
+        b->text = text;
+        b->callbackData = data;
+        row.push_back(b);
+        kb->inlineKeyboard.push_back(row);
+    }
+    return kb;
+}
+
+TgBot::InlineKeyboardMarkup::Ptr make_kb_row(const std::vector<std::pair<std::string, std::string>>& buttons) {
+    auto kb = TgBot::InlineKeyboardMarkup::Ptr(new TgBot::InlineKeyboardMarkup);
+    std::vector<TgBot::InlineKeyboardButton::Ptr> row;
+    for (const auto& [text, data] : buttons) {
+        auto b = TgBot::InlineKeyboardButton::Ptr(new TgBot::InlineKeyboardButton);
+        b->text = text;
+        b->callbackData = data;
+        row.push_back(b);
+    }
+    kb->inlineKeyboard.push_back(row);
+    return kb;
+}
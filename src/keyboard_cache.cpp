@@ -0,0 +1,97 @@
+#include "keyboard_cache.h"
+
+#include <string_view>
+
+#include "keyboard.h"
+#include "metrics.h"
+
+namespace {
+
+Counter& lookups(const std::string& result) {
+    return MetricsRegistry::instance().counter(
+        "tg_keyboard_cache_total", "Inline keyboard lookups, by result", metric_label("result", result));
+}
+
+Gauge& entries_gauge() {
+    static Gauge& g = MetricsRegistry::instance().gauge("tg_keyboard_cache_entries", "Interned inline keyboards");
+    return g;
+}
+
+void fnv1a(std::uint64_t& h, std::string_view s) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    // Field separator, so ("ab", "c") and ("a", "bc") differ.
+    h ^= 0xff;
+    h *= 1099511628211ULL;
+}
+
+} // namespace
+
+KeyboardCache::KeyboardCache(std::size_t max_entries) : max_entries_(max_entries) {}
+
+std::uint64_t KeyboardCache::hash(Layout layout, const Buttons& buttons) {
+    std::uint64_t h = 1469598103934665603ULL ^ static_cast<std::uint64_t>(layout);
+    for (const auto& [text, data] : buttons) {
+        fnv1a(h, text);
+        fnv1a(h, data);
+    }
+    return h;
+}
+
+TgBot::InlineKeyboardMarkup::Ptr KeyboardCache::get(const std::string& scope, Layout layout, const Buttons& buttons) {
+    static Counter& hits = lookups("hit");
+    static Counter& misses = lookups("miss");
+    auto build = [&] { return layout == Layout::ROW ? make_kb_row(buttons) : make_kb(buttons); };
+    if (max_entries_ == 0) return build();
+
+    const std::uint64_t h = hash(layout, buttons);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto [from, to] = index_.equal_range(h);
+        for (auto it = from; it != to; ++it) {
+            const Entry& e = *it->second;
+            if (e.layout == layout && e.scope == scope && e.buttons == buttons) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                hits.inc();
+                return e.markup;
+            }
+        }
+    }
+    misses.inc();
+    auto markup = build();
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    lru_.push_front(Entry{h, layout, scope, buttons, markup});
+    index_.emplace(h, lru_.begin());
+    while (lru_.size() > max_entries_) erase(std::prev(lru_.end()));
+    entries_gauge().set(static_cast<double>(lru_.size()));
+    return markup;
+}
+
+void KeyboardCache::invalidate(const std::string& scope) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        auto next = std::next(it);
+        if (it->scope == scope) erase(it);
+        it = next;
+    }
+    entries_gauge().set(static_cast<double>(lru_.size()));
+}
+
+std::size_t KeyboardCache::size() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return lru_.size();
+}
+
+void KeyboardCache::erase(Lru::iterator it) {
+    auto [from, to] = index_.equal_range(it->hash);
+    for (auto i = from; i != to; ++i) {
+        if (i->second == it) {
+            index_.erase(i);
+            break;
+        }
+    }
+    lru_.erase(it);
+}
@@ -1,14 +1,30 @@
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <thread>
 
 #include "auth_client.h"
+#include "flight_recorder.h"
 #include "main_client.h"
+#include "metrics_server.h"
 #include "redis_client.h"
 #include "session_store.h"
 #include "telegram_bot.h"
+#include "tracing.h"
+#include "update_capture.h"
 #include "util.h"
 
 int main() {
+    // Blocked before any thread starts so every thread inherits the mask and
+    // the watcher below is the only one that sees these signals.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
     const std::string tg_token = getenv_or("TG_BOT_TOKEN", "");
     if (tg_token.empty()) {
         std::cerr << "TG_BOT_TOKEN env var is required" << std::endl;
@@ -24,12 +40,51 @@ int main() {
     auto redis = std::make_shared<RedisClient>(redis_host, redis_port);
     auto store = std::make_shared<SessionStore>(redis);
 
-    if (!store->ping()) {
-        std::cerr << "Failed to connect to Redis at " << redis_host << ":" << redis_port << std::endl;
-        return 1;
+    // Up first so an orchestrator sees /health while the checks below run.
+    const int metrics_port = std::stoi(getenv_or("TG_METRICS_PORT", "0"));
+    MetricsServer metrics(getenv_or("TG_METRICS_HOST", "127.0.0.1"), metrics_port);
+    if (metrics_port > 0 && !metrics.start()) {
+        std::cerr << "Failed to start metrics listener on port " << metrics_port << std::endl;
+    }
+
+    const std::string trace_file = getenv_or("TG_TRACE_FILE", "");
+    if (!Tracer::instance().configure(trace_file, std::stod(getenv_or("TG_TRACE_SAMPLE", "0.1")))) {
+        std::cerr << "Failed to open trace file " << trace_file << std::endl;
+    }
+
+    const std::string capture_file = getenv_or("TG_CAPTURE_FILE", "");
+    if (!UpdateCapture::instance().configure(capture_file)) {
+        std::cerr << "Failed to open capture file " << capture_file << std::endl;
     }
 
     TelegramModuleBot bot(tg_token, store, AuthClient(auth_base), MainClient(main_base));
+    if (!bot.warm_up()) {
+        std::cerr << "Failed to connect to Redis at " << redis_host << ":" << redis_port << std::endl;
+        return 1;
+    }
+    // Keeps running through the drain: SIGUSR1 still dumps the flight recorder,
+    // and a second SIGTERM/SIGINT exits without waiting for the drain.
+    std::thread([&bot, &metrics, signals]() {
+        int sig = 0;
+        bool stopping = false;
+        while (sigwait(&signals, &sig) == 0) {
+            if (sig == SIGUSR1) {
+                FlightRecorder::instance().dump("signal");
+                continue;
+            }
+            if (stopping) {
+                std::cerr << "Got signal " << sig << " again, exiting now" << std::endl;
+                std::_Exit(1);
+            }
+            stopping = true;
+            std::cerr << "Got signal " << sig << ", shutting down" << std::endl;
+            metrics.set_readiness(MetricsServer::Readiness::DRAINING);
+            bot.request_stop();
+        }
+    }).detach();
+    FlightRecorder::instance().start();
+    metrics.set_readiness(MetricsServer::Readiness::READY);
     bot.run();
+    metrics.stop();
     return 0;
 }
@@ -1,37 +1,216 @@
 #include "main_client.h"
 
+#include <algorithm>
+#include <chrono>
 #include <utility>
 
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "util.h"
+
 using json = nlohmann::json;
 
-MainClient::MainClient(std::string base) : base_(std::move(base)) {}
+namespace {
+
+struct VerbMetrics {
+    const char* span_name;
+    Histogram& latency;
+    Counter& errors;
+};
+
+VerbMetrics verb_metrics(const char* span_name, const std::string& verb) {
+    auto& reg = MetricsRegistry::instance();
+    const auto label = metric_label("verb", verb);
+    return {span_name,
+            reg.histogram("tg_main_request_seconds", "Main backend request time, by verb", label),
+            reg.counter("tg_main_errors_total", "Main backend transport errors and 5xx responses, by verb", label)};
+}
+
+cpr::Response circuit_open() {
+    cpr::Response r;
+    r.status_code = 0;
+    r.error.code = cpr::ErrorCode::INTERNAL_ERROR;
+    r.error.message = "circuit open";
+    return r;
+}
+
+template <typename F>
+cpr::Response observed(CircuitBreaker& breaker, const VerbMetrics& m, const std::string& path, F&& call) {
+    if (!breaker.allow()) return circuit_open();
+    ScopedTimer timer(m.latency);
+    Span span(m.span_name, path);
+    FlightPhase phase(FlightRecorder::Phase::BACKEND);
+    const auto started = std::chrono::steady_clock::now();
+    auto r = call();
+    const bool failed = r.status_code == 0 || r.status_code >= 500;
+    breaker.record(!failed, std::chrono::steady_clock::now() - started);
+    if (failed) m.errors.inc();
+    return r;
+}
 
-cpr::Response MainClient::get(const std::string& path, const std::string& bearer) {
-    return cpr::Get(cpr::Url{base_ + path}, cpr::Header{{"Authorization", "Bearer " + bearer}});
+std::string header_value(const cpr::Response& r, const char* name) {
+    auto it = r.header.find(name);
+    return it == r.header.end() ? std::string{} : it->second;
 }
 
-cpr::Response MainClient::del(const std::string& path, const std::string& bearer) {
-    return cpr::Delete(cpr::Url{base_ + path}, cpr::Header{{"Authorization", "Bearer " + bearer}});
+Counter& cache_counter(const std::string& result) {
+    return MetricsRegistry::instance().counter(
+        "tg_main_cache_total", "Cacheable main backend GETs, by result", metric_label("result", result));
 }
 
-cpr::Response MainClient::post(const std::string& path, const std::string& bearer, const json* body) {
-    cpr::Header h{{"Authorization", "Bearer " + bearer}};
-    if (body) {
-        h["Content-Type"] = "application/json";
-        return cpr::Post(cpr::Url{base_ + path}, h, cpr::Body{body->dump()});
+} // namespace
+
+MainClient::MainClient(std::string base)
+    : base_(std::move(base)),
+      breaker_(std::make_shared<CircuitBreaker>("main")),
+      cache_(std::make_shared<ResponseCache>(
+          static_cast<std::size_t>(std::max(0, std::stoi(getenv_or("TG_HTTP_CACHE_ENTRIES", "2000")))),
+          static_cast<std::size_t>(std::max(0, std::stoi(getenv_or("TG_HTTP_CACHE_MAX_BODY", "262144")))))) {}
+
+bool MainClient::reachable(std::int32_t timeout_ms) const {
+    auto r = cpr::Get(cpr::Url{base_ + "/"}, cpr::Timeout{timeout_ms}, cpr::ConnectTimeout{timeout_ms});
+    return r.status_code != 0 && r.status_code < 500;
+}
+
+cpr::Response MainClient::cached_get(const std::string& path,
+                                     const std::string& bearer,
+                                     const CallLimits& limits,
+                                     const std::function<bool(std::string_view)>* on_data,
+                                     std::shared_ptr<const ResponseCache::Entry>* entry) {
+    static const VerbMetrics m = verb_metrics("main.GET", "GET");
+    static Counter& revalidated = cache_counter("revalidated");
+    static Counter& stored = cache_counter("stored");
+
+    const bool caching = cache_->enabled();
+    const std::string key = caching ? ResponseCache::key(bearer, path) : std::string{};
+    const auto cached = caching ? cache_->find(key) : nullptr;
+
+    // A streamed body is only kept if it fits the cache.
+    std::string streamed;
+    bool oversized = false;
+    auto r = observed(*breaker_, m, path, [&] {
+        cpr::Header h{{"Authorization", "Bearer " + bearer}};
+        if (cached) {
+            if (!cached->etag.empty()) h["If-None-Match"] = cached->etag;
+            if (!cached->last_modified.empty()) h["If-Modified-Since"] = cached->last_modified;
+        }
+        const cpr::Url url{base_ + path};
+        const cpr::Timeout timeout{limits.timeout_ms};
+        const cpr::ConnectTimeout connect{limits.connect_timeout_ms};
+        if (!on_data) return cpr::Get(url, h, timeout, connect);
+        return cpr::Get(url, h, timeout, connect, cpr::WriteCallback{[&](auto data, intptr_t) -> bool {
+                            if (caching && !oversized) {
+                                if (streamed.size() + data.size() > cache_->max_body()) {
+                                    oversized = true;
+                                    std::string().swap(streamed);
+                                } else {
+                                    streamed.append(data.data(), data.size());
+                                }
+                            }
+                            return (*on_data)(std::string_view(data.data(), data.size()));
+                        }});
+    });
+
+    if (r.status_code == 304 && cached) {
+        revalidated.inc();
+        r.status_code = 200;
+        if (on_data) (*on_data)(cached->body);
+        *entry = cached;
+        return r;
+    }
+    if (!caching || r.status_code != 200 || r.error) return r;
+    if (oversized) {
+        cache_->erase(key);
+        return r;
+    }
+    *entry = cache_->put(key, header_value(r, "ETag"), header_value(r, "Last-Modified"), on_data ? std::move(streamed) : r.text);
+    if (*entry) stored.inc();
+    return r;
+}
+
+cpr::Response MainClient::get(const std::string& path, const std::string& bearer, const CallLimits& limits) {
+    std::shared_ptr<const ResponseCache::Entry> entry;
+    auto r = cached_get(path, bearer, limits, nullptr, &entry);
+    if (entry && r.text.empty()) r.text = entry->body;
+    return r;
+}
+
+MainClient::JsonGet MainClient::get_json(const std::string& path, const std::string& bearer, const CallLimits& limits) {
+    std::shared_ptr<const ResponseCache::Entry> entry;
+    JsonGet out{cached_get(path, bearer, limits, nullptr, &entry), nullptr};
+    if (entry) {
+        // Parsed once per entry; a later 304 shares the same document.
+        out.body = entry->json();
+    } else if (out.response.status_code == 200) {
+        try {
+            out.body = std::make_shared<const json>(json::parse(out.response.text));
+        } catch (...) {
+        }
     }
-    return cpr::Post(cpr::Url{base_ + path}, h);
+    return out;
+}
+
+cpr::Response MainClient::get_stream(const std::string& path,
+                                     const std::string& bearer,
+                                     const std::function<bool(std::string_view)>& on_data,
+                                     const CallLimits& limits) {
+    std::shared_ptr<const ResponseCache::Entry> entry;
+    return cached_get(path, bearer, limits, &on_data, &entry);
+}
+
+cpr::Response MainClient::del(const std::string& path, const std::string& bearer, const CallLimits& limits) {
+    static const VerbMetrics m = verb_metrics("main.DELETE", "DELETE");
+    return observed(*breaker_, m, path, [&] {
+        return cpr::Delete(cpr::Url{base_ + path},
+                           cpr::Header{{"Authorization", "Bearer " + bearer}},
+                           cpr::Timeout{limits.timeout_ms},
+                           cpr::ConnectTimeout{limits.connect_timeout_ms});
+    });
+}
+
+cpr::Response MainClient::post(const std::string& path,
+                               const std::string& bearer,
+                               const json* body,
+                               const CallLimits& limits) {
+    static const VerbMetrics m = verb_metrics("main.POST", "POST");
+    return observed(*breaker_, m, path, [&] {
+        cpr::Header h{{"Authorization", "Bearer " + bearer}};
+        const cpr::Timeout timeout{limits.timeout_ms};
+        const cpr::ConnectTimeout connect{limits.connect_timeout_ms};
+        if (body) {
+            h["Content-Type"] = "application/json";
+            return cpr::Post(cpr::Url{base_ + path}, h, cpr::Body{body->dump()}, timeout, connect);
+        }
+        return cpr::Post(cpr::Url{base_ + path}, h, timeout, connect);
+    });
 }
 
 cpr::Response MainClient::post_params(const std::string& path,
                                       const std::string& bearer,
-                                      const cpr::Parameters& params) {
-    return cpr::Post(cpr::Url{base_ + path}, cpr::Header{{"Authorization", "Bearer " + bearer}}, params);
+                                      const cpr::Parameters& params,
+                                      const CallLimits& limits) {
+    static const VerbMetrics m = verb_metrics("main.POST", "POST");
+    return observed(*breaker_, m, path, [&] {
+        return cpr::Post(cpr::Url{base_ + path},
+                         cpr::Header{{"Authorization", "Bearer " + bearer}},
+                         params,
+                         cpr::Timeout{limits.timeout_ms},
+                         cpr::ConnectTimeout{limits.connect_timeout_ms});
+    });
 }
 
-cpr::Response MainClient::patch(const std::string& path, const std::string& bearer, const json& body) {
-    return cpr::Patch(
-        cpr::Url{base_ + path},
-        cpr::Header{{"Authorization", "Bearer " + bearer}, {"Content-Type", "application/json"}},
-        cpr::Body{body.dump()});
+cpr::Response MainClient::patch(const std::string& path,
+                                const std::string& bearer,
+                                const json& body,
+                                const CallLimits& limits) {
+    static const VerbMetrics m = verb_metrics("main.PATCH", "PATCH");
+    return observed(*breaker_, m, path, [&] {
+        return cpr::Patch(
+            cpr::Url{base_ + path},
+            cpr::Header{{"Authorization", "Bearer " + bearer}, {"Content-Type", "application/json"}},
+            cpr::Body{body.dump()},
+            cpr::Timeout{limits.timeout_ms},
+            cpr::ConnectTimeout{limits.connect_timeout_ms});
+    });
 }
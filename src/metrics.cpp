@@ -0,0 +1,204 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+std::size_t shard_index() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t idx = next.fetch_add(1, std::memory_order_relaxed);
+    return idx;
+}
+
+int msb(std::uint64_t v) { return 63 - __builtin_clzll(v); }
+
+std::string format_double(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+std::string join_labels(const std::string& labels, const std::string& extra) {
+    if (labels.empty()) return "{" + extra + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+std::string braced(const std::string& labels) { return labels.empty() ? "" : "{" + labels + "}"; }
+
+// Exported `le` boundaries are whole octaves so they line up with the internal buckets:
+// 2^7us (128us) .. 2^24us (~16.8s).
+constexpr int kFirstExportedOctave = 7;
+constexpr int kLastExportedOctave = 24;
+
+} // namespace
+
+void Counter::inc(std::uint64_t n) {
+    shards_[shard_index() % kShards].v.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t Counter::value() const {
+    std::uint64_t sum = 0;
+    for (const auto& s : shards_) sum += s.v.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Gauge::add(double d) {
+    double cur = v_.load(std::memory_order_relaxed);
+    while (!v_.compare_exchange_weak(cur, cur + d, std::memory_order_relaxed)) {
+    }
+}
+
+std::size_t Histogram::bucket_for(std::uint64_t us) {
+    if (us < 4) return static_cast<std::size_t>(us);
+    int m = msb(us);
+    if (m > 30) return kBuckets - 1;
+    std::size_t sub = static_cast<std::size_t>((us >> (m - 2)) & 3);
+    return 4 + static_cast<std::size_t>(m - 2) * 4 + sub;
+}
+
+std::uint64_t Histogram::bucket_upper_us(std::size_t idx) {
+    if (idx < 4) return idx + 1;
+    std::size_t m = (idx - 4) / 4 + 2;
+    std::uint64_t sub = (idx - 4) % 4;
+    return (5 + sub) << (m - 2);
+}
+
+void Histogram::observe_us(std::uint64_t us) {
+    buckets_[bucket_for(us)].fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(us, std::memory_order_relaxed);
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    observe_us(us < 0 ? 0 : static_cast<std::uint64_t>(us));
+}
+
+std::uint64_t Histogram::count() const {
+    std::uint64_t n = 0;
+    for (const auto& b : buckets_) n += b.load(std::memory_order_relaxed);
+    return n;
+}
+
+std::uint64_t Histogram::quantile_us(double q) const {
+    std::array<std::uint64_t, kBuckets> snap{};
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        snap[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += snap[i];
+    }
+    if (total == 0) return 0;
+    auto target = static_cast<std::uint64_t>(q * static_cast<double>(total));
+    if (target == 0) target = 1;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        seen += snap[i];
+        if (seen >= target) return bucket_upper_us(i);
+    }
+    return bucket_upper_us(kBuckets - 1);
+}
+
+std::uint64_t Histogram::count_below_pow2(int k) const {
+    std::size_t end = k <= 2 ? (std::size_t{1} << k) : 4 + static_cast<std::size_t>(k - 2) * 4;
+    if (end > kBuckets) end = kBuckets;
+    std::uint64_t n = 0;
+    for (std::size_t i = 0; i < end; ++i) n += buckets_[i].load(std::memory_order_relaxed);
+    return n;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry r;
+    return r;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series_for(const std::string& name,
+                                                     const std::string& help,
+                                                     Type type,
+                                                     const std::string& labels) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    Family* fam = nullptr;
+    for (auto& f : families_) {
+        if (f->name == name) {
+            fam = f.get();
+            break;
+        }
+    }
+    if (!fam) {
+        families_.push_back(std::make_unique<Family>());
+        fam = families_.back().get();
+        fam->name = name;
+        fam->help = help;
+        fam->type = type;
+    }
+    for (auto& s : fam->series) {
+        if (s->labels == labels) return *s;
+    }
+    auto s = std::make_unique<Series>();
+    s->labels = labels;
+    switch (fam->type) {
+        case Type::COUNTER: s->counter = std::make_unique<Counter>(); break;
+        case Type::GAUGE: s->gauge = std::make_unique<Gauge>(); break;
+        case Type::HISTOGRAM: s->histogram = std::make_unique<Histogram>(); break;
+    }
+    fam->series.push_back(std::move(s));
+    return *fam->series.back();
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series_for(name, help, Type::COUNTER, labels).counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series_for(name, help, Type::GAUGE, labels).gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+    return *series_for(name, help, Type::HISTOGRAM, labels).histogram;
+}
+
+std::string MetricsRegistry::render() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    std::ostringstream out;
+    for (const auto& f : families_) {
+        out << "# HELP " << f->name << " " << f->help << "\n";
+        switch (f->type) {
+            case Type::COUNTER: out << "# TYPE " << f->name << " counter\n"; break;
+            case Type::GAUGE: out << "# TYPE " << f->name << " gauge\n"; break;
+            case Type::HISTOGRAM: out << "# TYPE " << f->name << " histogram\n"; break;
+        }
+        for (const auto& s : f->series) {
+            if (s->counter) {
+                out << f->name << braced(s->labels) << " " << s->counter->value() << "\n";
+            } else if (s->gauge) {
+                out << f->name << braced(s->labels) << " " << format_double(s->gauge->value()) << "\n";
+            } else if (s->histogram) {
+                const auto& h = *s->histogram;
+                for (int k = kFirstExportedOctave; k <= kLastExportedOctave; ++k) {
+                    double le = static_cast<double>(std::uint64_t{1} << k) / 1e6;
+                    out << f->name << "_bucket" << join_labels(s->labels, "le=\"" + format_double(le) + "\"") << " "
+                        << h.count_below_pow2(k) << "\n";
+                }
+                const auto total = h.count();
+                out << f->name << "_bucket" << join_labels(s->labels, "le=\"+Inf\"") << " " << total << "\n";
+                out << f->name << "_sum" << braced(s->labels) << " "
+                    << format_double(static_cast<double>(h.sum_us()) / 1e6) << "\n";
+                out << f->name << "_count" << braced(s->labels) << " " << total << "\n";
+            }
+        }
+    }
+    return out.str();
+}
+
+std::string metric_label(const std::string& key, const std::string& value) {
+    std::string out = key + "=\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') out.push_back('\\');
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
@@ -0,0 +1,152 @@
+#include "metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+#include "metrics.h"
+
+namespace {
+
+// Scrapes and probes in flight at once; past this a connection is closed unread.
+constexpr int kMaxConnections = 16;
+
+void write_all(int fd, const std::string& data) {
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t w = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (w <= 0) return;
+        sent += static_cast<std::size_t>(w);
+    }
+}
+
+std::string http_response(int code, const std::string& reason, const std::string& content_type, const std::string& body) {
+    return "HTTP/1.0 " + std::to_string(code) + " " + reason + "\r\n" + "Content-Type: " + content_type + "\r\n" +
+           "Content-Length: " + std::to_string(body.size()) + "\r\n" + "Connection: close\r\n\r\n" + body;
+}
+
+bool is_get(const std::string& line, const std::string& path) {
+    const std::string prefix = "GET " + path;
+    return line == prefix || line.rfind(prefix + " ", 0) == 0;
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(std::string host, int port) : host_(std::move(host)), port_(port) {}
+
+bool MetricsServer::start() {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) return false;
+
+    int one = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(port_));
+    if (::inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1 ||
+        ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd_, 16) != 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    acceptor_ = std::thread([this]() { serve(); });
+    return true;
+}
+
+MetricsServer::~MetricsServer() { stop(); }
+
+void MetricsServer::stop() {
+    if (!acceptor_.joinable()) return;
+    stopping_.store(true);
+    // Wakes the blocked accept().
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    acceptor_.join();
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+    // Connection threads are bounded by the socket timeouts set in handle().
+    std::unique_lock<std::mutex> lk(conn_mtx_);
+    conn_cv_.wait(lk, [this] { return active_ == 0; });
+}
+
+void MetricsServer::serve() {
+    while (!stopping_.load()) {
+        int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (stopping_.load()) break;
+            // Out of descriptors or memory: retrying at once only spins.
+            if (errno != EINTR && errno != ECONNABORTED) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(conn_mtx_);
+            if (active_ >= kMaxConnections) {
+                ::close(fd);
+                continue;
+            }
+            ++active_;
+        }
+        // Each connection on its own thread, so a slow reader cannot hold up /health and /ready.
+        std::thread([this, fd]() {
+            handle(fd);
+            ::close(fd);
+            std::lock_guard<std::mutex> lk(conn_mtx_);
+            --active_;
+            conn_cv_.notify_all();
+        }).detach();
+    }
+}
+
+void MetricsServer::set_readiness(Readiness r) {
+    static Gauge& ready = MetricsRegistry::instance().gauge("tg_readiness", "0 starting, 1 ready, 2 draining");
+    readiness_.store(r);
+    ready.set(static_cast<double>(r));
+}
+
+void MetricsServer::handle(int fd) {
+    timeval tv{};
+    tv.tv_sec = 2;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Only the request line matters; read until the end of headers or 8 KiB.
+    std::string req;
+    char buf[1024];
+    while (req.size() < 8192 && req.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        req.append(buf, static_cast<std::size_t>(n));
+    }
+
+    auto line_end = req.find("\r\n");
+    const std::string line = req.substr(0, line_end);
+    if (is_get(line, "/metrics")) {
+        write_all(fd, http_response(200, "OK", "text/plain; version=0.0.4", MetricsRegistry::instance().render()));
+        return;
+    }
+    if (is_get(line, "/health")) {
+        write_all(fd, http_response(200, "OK", "text/plain", "ok\n"));
+        return;
+    }
+    if (is_get(line, "/ready")) {
+        switch (readiness_.load()) {
+            case Readiness::READY: write_all(fd, http_response(200, "OK", "text/plain", "ready\n")); return;
+            case Readiness::STARTING:
+                write_all(fd, http_response(503, "Service Unavailable", "text/plain", "starting\n"));
+                return;
+            case Readiness::DRAINING:
+                write_all(fd, http_response(503, "Service Unavailable", "text/plain", "draining\n"));
+                return;
+        }
+    }
+    write_all(fd, http_response(404, "Not Found", "text/plain", "not found\n"));
+}
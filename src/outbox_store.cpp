@@ -0,0 +1,55 @@
+#include "outbox_store.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "metrics.h"
+#include "util.h"
+
+OutboxStore::OutboxStore(std::shared_ptr<RedisClient> redis, const std::string& prefix, std::string consumer)
+    : redis_(std::move(redis)),
+      stream_(prefix + ":outbox"),
+      consumer_(std::move(consumer)),
+      maxlen_(std::max(0LL, std::stoll(getenv_or("TG_OUTBOX_MAXLEN", "100000")))) {}
+
+bool OutboxStore::ensure_group() { return redis_->xgroup_create(stream_, group_); }
+
+bool OutboxStore::enqueue(std::int64_t chatId, const std::string& text) {
+    static Counter& enqueued = MetricsRegistry::instance().counter("tg_outbox_enqueued_total", "Messages queued for delivery");
+    if (!redis_->xadd(stream_, {{"chat", std::to_string(chatId)}, {"text", text}}, maxlen_)) return false;
+    enqueued.inc();
+    return true;
+}
+
+std::vector<OutboxStore::Message> OutboxStore::read(std::size_t count) {
+    return to_messages(redis_->xreadgroup(group_, consumer_, stream_, count));
+}
+
+std::vector<OutboxStore::Message> OutboxStore::reclaim(std::chrono::milliseconds min_idle, std::size_t count) {
+    static Counter& reclaimed =
+        MetricsRegistry::instance().counter("tg_outbox_reclaimed_total", "Pending messages taken over from a stalled sender");
+    auto out = to_messages(redis_->xautoclaim(stream_, group_, consumer_, min_idle.count(), &claim_cursor_, count));
+    reclaimed.inc(out.size());
+    return out;
+}
+
+bool OutboxStore::ack(const std::string& id) { return redis_->xack(stream_, group_, id) > 0; }
+
+std::vector<OutboxStore::Message> OutboxStore::to_messages(const std::vector<RedisClient::StreamEntry>& entries) {
+    std::vector<Message> out;
+    out.reserve(entries.size());
+    for (const auto& e : entries) {
+        Message m;
+        m.id = e.id;
+        const std::string* chat = e.field("chat");
+        const std::string* text = e.field("text");
+        long long chatId = 0;
+        // Malformed entries are passed on with chat_id 0 so the caller acks them away.
+        if (chat && text && parse_int(*chat, &chatId)) {
+            m.chat_id = chatId;
+            m.text = *text;
+        }
+        out.push_back(std::move(m));
+    }
+    return out;
+}
@@ -0,0 +1,171 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "metrics.h"
+#include "util.h"
+
+namespace {
+
+const char* class_name(RateLimiter::Class c) {
+    switch (c) {
+        case RateLimiter::Class::ACCOUNT: return "account";
+        case RateLimiter::Class::LISTING: return "listing";
+        case RateLimiter::Class::WRITE: return "write";
+        case RateLimiter::Class::QUIZ: return "quiz";
+        case RateLimiter::Class::UNKNOWN: return "unknown";
+    }
+    return "?";
+}
+
+bool env_on(const char* key, const char* fallback) {
+    bool on = false;
+    return parse_bool_flag(getenv_or(key, fallback), &on) && on;
+}
+
+double env_num(const std::string& key, int fallback) {
+    return std::max(0, std::stoi(getenv_or(key.c_str(), std::to_string(fallback))));
+}
+
+// Telegram chat ids fit in 52 bits, which leaves room for the class.
+std::uint64_t bucket_key(std::int64_t chatId, RateLimiter::Class c) {
+    return (static_cast<std::uint64_t>(chatId) << 3) | static_cast<std::uint64_t>(c);
+}
+
+std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    return x ^ (x >> 33);
+}
+
+// KEYS[1] window zset; ARGV: now ms, window ms, limit, unique member.
+// Returns 1 and records the call if fewer than `limit` fall in the window.
+constexpr const char* kWindowScript =
+    "redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', tonumber(ARGV[1]) - tonumber(ARGV[2]))\n"
+    "if redis.call('ZCARD', KEYS[1]) >= tonumber(ARGV[3]) then return 0 end\n"
+    "redis.call('ZADD', KEYS[1], ARGV[1], ARGV[4])\n"
+    "redis.call('PEXPIRE', KEYS[1], ARGV[2])\n"
+    "return 1";
+
+} // namespace
+
+RateLimiter::RateLimiter(std::shared_ptr<RedisClient> redis, const std::string& prefix)
+    : redis_(std::move(redis)),
+      prefix_(prefix + ":rl:"),
+      enabled_(env_on("TG_RATE_LIMIT", "1")),
+      shared_(env_on("TG_RATE_REDIS", "0")),
+      max_per_shard_(std::max<std::size_t>(1, static_cast<std::size_t>(env_num("TG_RATE_MAX_BUCKETS", 200000)) / kShards)) {
+    struct Default {
+        Class c;
+        const char* env;
+        int per_min;
+        int burst;
+    };
+    const Default defaults[] = {{Class::ACCOUNT, "ACCOUNT", 12, 5},
+                                {Class::LISTING, "LISTING", 30, 5},
+                                {Class::WRITE, "WRITE", 60, 10},
+                                {Class::QUIZ, "QUIZ", 240, 30},
+                                {Class::UNKNOWN, "UNKNOWN", 12, 3}};
+    for (const auto& d : defaults) {
+        const std::string base = std::string("TG_RATE_") + d.env;
+        const auto i = static_cast<std::size_t>(d.c);
+        limits_[i].per_sec = env_num(base + "_PER_MIN", d.per_min) / 60.0;
+        limits_[i].burst = std::max(1.0, env_num(base + "_BURST", d.burst));
+        limited_[i] = &MetricsRegistry::instance().counter(
+            "tg_rate_limited_total", "Updates refused by admission control, by command class",
+            metric_label("class", class_name(d.c)));
+    }
+    global_.per_sec = env_num("TG_RATE_GLOBAL_PER_SEC", 0);
+    // A second's worth of headroom.
+    global_.burst = std::max(1.0, global_.per_sec);
+    global_bucket_.tokens = global_.burst;
+    global_bucket_.last = std::chrono::steady_clock::now();
+}
+
+RateLimiter::Class RateLimiter::classify(std::string_view handler) {
+    if (handler == "start" || handler == "help" || handler == "login" || handler == "logout") return Class::ACCOUNT;
+    if (handler == "courses" || handler == "users" || handler == "me" || handler == "cb_course" ||
+        handler == "cb_back_courses" || handler == "cb_users_page") {
+        return Class::LISTING;
+    }
+    if (handler == "cb_test" || handler == "cb_answer" || handler == "cb_finish") return Class::QUIZ;
+    if (handler == "ban" || handler == "unban" || handler == "set_full_name" || handler == "course_create" ||
+        handler == "course_delete" || handler == "test_create" || handler == "test_delete" ||
+        handler == "question_create") {
+        return Class::WRITE;
+    }
+    return Class::UNKNOWN;
+}
+
+bool RateLimiter::take(Bucket& b, const Limit& l, std::chrono::steady_clock::time_point now) {
+    const double elapsed = std::chrono::duration<double>(now - b.last).count();
+    b.tokens = std::min(l.burst, b.tokens + elapsed * l.per_sec);
+    b.last = now;
+    if (b.tokens < 1.0) return false;
+    b.tokens -= 1.0;
+    return true;
+}
+
+RateLimiter::Verdict RateLimiter::admit(std::int64_t chatId, Class c) {
+    static Counter& global_limited = MetricsRegistry::instance().counter(
+        "tg_rate_limited_global_total", "Updates refused by the process-wide admission cap");
+    if (!enabled_) return Verdict::ADMIT;
+
+    const auto i = static_cast<std::size_t>(c);
+    const Limit& l = limits_[i];
+    const std::uint64_t key = bucket_key(chatId, c);
+    const auto now = std::chrono::steady_clock::now();
+    if (l.per_sec > 0) {
+        Shard& sh = shards_[mix(key) % kShards];
+        std::lock_guard<std::mutex> lk(sh.mtx);
+        if (sh.buckets.size() >= max_per_shard_) prune(sh, now);
+        Bucket& b = sh.buckets.try_emplace(key, Bucket{l.burst, now, false}).first->second;
+        if (!take(b, l, now)) {
+            limited_[i]->inc();
+            if (b.warned) return Verdict::REJECT_QUIET;
+            b.warned = true;
+            return Verdict::REJECT;
+        }
+        b.warned = false;
+    }
+
+    if (global_.per_sec <= 0) return Verdict::ADMIT;
+    std::lock_guard<std::mutex> lk(global_mtx_);
+    if (take(global_bucket_, global_, now)) return Verdict::ADMIT;
+    // Overload, not one chat misbehaving: replying would only add to it.
+    global_limited.inc();
+    return Verdict::REJECT_QUIET;
+}
+
+bool RateLimiter::admit_shared(std::int64_t chatId, Class c) {
+    if (!enabled_ || !shared_) return true;
+    const auto i = static_cast<std::size_t>(c);
+    const Limit& l = limits_[i];
+    if (l.per_sec <= 0) return true;
+    // The window that holds `burst` calls at the sustained rate.
+    const auto window_ms = static_cast<long long>(std::ceil(l.burst / l.per_sec * 1000.0));
+    const auto now_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const std::string key = prefix_ + class_name(c) + ":" + std::to_string(chatId);
+    const std::string member = std::to_string(now_ms) + ":" + random_token(12);
+    auto r = redis_->eval_int(kWindowScript,
+                              {key},
+                              {std::to_string(now_ms),
+                               std::to_string(window_ms),
+                               std::to_string(static_cast<long long>(l.burst)),
+                               member});
+    if (!r || *r != 0) return true;
+    limited_[i]->inc();
+    return false;
+}
+
+void RateLimiter::prune(Shard& sh, std::chrono::steady_clock::time_point now) {
+    std::erase_if(sh.buckets, [&](const auto& kv) {
+        const Limit& l = limits_[static_cast<std::size_t>(kv.first & 7)];
+        const double elapsed = std::chrono::duration<double>(now - kv.second.last).count();
+        return kv.second.tokens + elapsed * l.per_sec >= l.burst;
+    });
+    // Still full of active chats: start over rather than grow without bound.
+    if (sh.buckets.size() >= max_per_shard_) sh.buckets.clear();
+}
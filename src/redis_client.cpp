@@ -2,13 +2,81 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <sstream>
+#include <unordered_map>
 #include <utility>
 
-RedisClient::RedisClient(std::string host, int port) : host_(std::move(host)), port_(port) {}
+#include "metrics.h"
+#include "tracing.h"
+#include "util.h"
+
+namespace {
+
+Histogram& command_latency(const std::string& name) {
+    thread_local std::unordered_map<std::string, Histogram*> cache;
+    auto it = cache.find(name);
+    if (it != cache.end()) return *it->second;
+    auto& h = MetricsRegistry::instance().histogram(
+        "tg_redis_command_seconds", "Redis command round-trip time", metric_label("cmd", name));
+    cache.emplace(name, &h);
+    return h;
+}
+
+// Commands that change nothing, so they may be sent again after the reply was lost.
+bool read_only(const std::string& name) {
+    return name == "GET" || name == "MGET" || name == "PING" || name == "SMEMBERS" || name == "SSCAN" ||
+           name == "LRANGE";
+}
+
+// The default pool covers every thread that issues commands: the dispatcher
+// workers and the I/O threads.
+std::string default_pool_size() {
+    return std::to_string(std::max(1, std::stoi(getenv_or("TG_WORKERS", "8"))) +
+                          std::max(1, std::stoi(getenv_or("TG_IO_THREADS", "16"))));
+}
+
+Gauge& open_connections() {
+    static Gauge& g = MetricsRegistry::instance().gauge("tg_redis_connections", "Open Redis connections, idle or in use");
+    return g;
+}
+
+} // namespace
+
+RedisClient::RedisClient(std::string host, int port)
+    : host_(std::move(host)),
+      port_(port),
+      pool_max_(static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_REDIS_POOL", default_pool_size()))))),
+      acquire_timeout_(std::max(1, std::stoi(getenv_or("TG_REDIS_ACQUIRE_MS", "2000")))) {}
+
+RedisClient::~RedisClient() {
+    for (int fd : idle_) ::close(fd);
+}
+
+std::size_t RedisClient::warm(std::size_t n) {
+    n = std::min(n, pool_max_);
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (idle_.size() >= n) return open_;
+    }
+    while (fds.size() < n) {
+        bool reused = false;
+        const int fd = acquire(&reused);
+        if (fd < 0) break;
+        fds.push_back(fd);
+    }
+    for (int fd : fds) release(fd, true);
+    std::lock_guard<std::mutex> lk(mtx_);
+    return open_;
+}
 
 bool RedisClient::ping() {
     auto r = cmd({"PING"});
@@ -61,6 +129,164 @@ std::vector<std::string> RedisClient::smembers(const std::string& setKey) {
     return out;
 }
 
+std::vector<std::string> RedisClient::sscan(const std::string& setKey, std::string* cursor, std::size_t count) {
+    std::vector<std::string> out;
+    auto r = cmd({"SSCAN", setKey, *cursor, "COUNT", std::to_string(count)});
+    // [next-cursor, [member...]]
+    if (!r || r->type != Resp::Type::Array || r->arr.size() < 2) {
+        *cursor = "0";
+        return out;
+    }
+    *cursor = r->arr[0].str;
+    out.reserve(r->arr[1].arr.size());
+    for (auto& it : r->arr[1].arr) {
+        if (it.type == Resp::Type::BulkString) out.push_back(std::move(it.str));
+    }
+    return out;
+}
+
+std::vector<std::optional<std::string>> RedisClient::mget(const std::vector<std::string>& keys) {
+    std::vector<std::optional<std::string>> out;
+    if (keys.empty()) return out;
+    std::vector<std::string> args;
+    args.reserve(keys.size() + 1);
+    args.push_back("MGET");
+    args.insert(args.end(), keys.begin(), keys.end());
+    auto r = cmd(args);
+    if (!r || r->type != Resp::Type::Array || r->arr.size() != keys.size()) return out;
+    out.reserve(keys.size());
+    for (auto& it : r->arr) {
+        if (it.type == Resp::Type::BulkString) {
+            out.emplace_back(std::move(it.str));
+        } else {
+            out.emplace_back(std::nullopt);
+        }
+    }
+    return out;
+}
+
+bool RedisClient::expire(const std::string& key, int ttlSeconds) {
+    auto r = cmd({"EXPIRE", key, std::to_string(ttlSeconds)});
+    return r && r->type == Resp::Type::Integer && r->i == 1;
+}
+
+std::optional<long long> RedisClient::eval_int(const std::string& script,
+                                               const std::vector<std::string>& keys,
+                                               const std::vector<std::string>& args) {
+    std::vector<std::string> c;
+    c.reserve(3 + keys.size() + args.size());
+    c.push_back("EVAL");
+    c.push_back(script);
+    c.push_back(std::to_string(keys.size()));
+    c.insert(c.end(), keys.begin(), keys.end());
+    c.insert(c.end(), args.begin(), args.end());
+    auto r = cmd(c);
+    if (!r || r->type != Resp::Type::Integer) return std::nullopt;
+    return r->i;
+}
+
+long long RedisClient::rpush(const std::string& key, const std::string& value) {
+    auto r = cmd({"RPUSH", key, value});
+    if (!r || r->type != Resp::Type::Integer) return 0;
+    return r->i;
+}
+
+std::optional<std::vector<std::string>> RedisClient::lrange(const std::string& key, long long start, long long stop) {
+    auto r = cmd({"LRANGE", key, std::to_string(start), std::to_string(stop)});
+    if (!r || r->type != Resp::Type::Array) return std::nullopt;
+    std::vector<std::string> out;
+    out.reserve(r->arr.size());
+    for (auto& it : r->arr) {
+        if (it.type == Resp::Type::BulkString) out.push_back(std::move(it.str));
+    }
+    return out;
+}
+
+bool RedisClient::ltrim(const std::string& key, long long start, long long stop) {
+    auto r = cmd({"LTRIM", key, std::to_string(start), std::to_string(stop)});
+    return r && r->type == Resp::Type::SimpleString && r->str == "OK";
+}
+
+const std::string* RedisClient::StreamEntry::field(const std::string& name) const {
+    for (const auto& [k, v] : fields) {
+        if (k == name) return &v;
+    }
+    return nullptr;
+}
+
+std::optional<std::string> RedisClient::xadd(const std::string& stream,
+                                             const std::vector<std::pair<std::string, std::string>>& fields,
+                                             long long maxlen) {
+    std::vector<std::string> args = {"XADD", stream};
+    if (maxlen > 0) {
+        args.push_back("MAXLEN");
+        args.push_back("~");
+        args.push_back(std::to_string(maxlen));
+    }
+    args.push_back("*");
+    for (const auto& [k, v] : fields) {
+        args.push_back(k);
+        args.push_back(v);
+    }
+    auto r = cmd(args);
+    if (!r || r->type != Resp::Type::BulkString) return std::nullopt;
+    return r->str;
+}
+
+bool RedisClient::xgroup_create(const std::string& stream, const std::string& group) {
+    auto r = cmd({"XGROUP", "CREATE", stream, group, "0", "MKSTREAM"});
+    if (!r) return false;
+    if (r->type == Resp::Type::Error) return r->str.rfind("BUSYGROUP", 0) == 0;
+    return r->type == Resp::Type::SimpleString;
+}
+
+std::vector<RedisClient::StreamEntry> RedisClient::xreadgroup(const std::string& group,
+                                                              const std::string& consumer,
+                                                              const std::string& stream,
+                                                              std::size_t count) {
+    auto r = cmd({"XREADGROUP", "GROUP", group, consumer, "COUNT", std::to_string(count), "STREAMS", stream, ">"});
+    // [[stream, [entry...]]], or nil when there is nothing new.
+    if (!r || r->type != Resp::Type::Array || r->arr.empty()) return {};
+    const Resp& per_stream = r->arr[0];
+    if (per_stream.type != Resp::Type::Array || per_stream.arr.size() < 2) return {};
+    return stream_entries(per_stream.arr[1]);
+}
+
+long long RedisClient::xack(const std::string& stream, const std::string& group, const std::string& id) {
+    auto r = cmd({"XACK", stream, group, id});
+    if (!r || r->type != Resp::Type::Integer) return 0;
+    return r->i;
+}
+
+std::vector<RedisClient::StreamEntry> RedisClient::xautoclaim(const std::string& stream,
+                                                              const std::string& group,
+                                                              const std::string& consumer,
+                                                              long long min_idle_ms,
+                                                              std::string* cursor,
+                                                              std::size_t count) {
+    auto r = cmd({"XAUTOCLAIM", stream, group, consumer, std::to_string(min_idle_ms), *cursor, "COUNT", std::to_string(count)});
+    // [next-cursor, [entry...]] plus, since Redis 7, the ids of deleted entries.
+    if (!r || r->type != Resp::Type::Array || r->arr.size() < 2) return {};
+    if (r->arr[0].type == Resp::Type::BulkString || r->arr[0].type == Resp::Type::SimpleString) *cursor = r->arr[0].str;
+    return stream_entries(r->arr[1]);
+}
+
+std::vector<RedisClient::StreamEntry> RedisClient::stream_entries(const Resp& list) {
+    std::vector<StreamEntry> out;
+    if (list.type != Resp::Type::Array) return out;
+    out.reserve(list.arr.size());
+    for (const auto& e : list.arr) {
+        // Entries trimmed away while pending come back as nil.
+        if (e.type != Resp::Type::Array || e.arr.size() < 2 || e.arr[1].type != Resp::Type::Array) continue;
+        StreamEntry entry;
+        entry.id = e.arr[0].str;
+        const auto& kv = e.arr[1].arr;
+        for (std::size_t i = 0; i + 1 < kv.size(); i += 2) entry.fields.emplace_back(kv[i].str, kv[i + 1].str);
+        out.push_back(std::move(entry));
+    }
+    return out;
+}
+
 std::string RedisClient::encode(const std::vector<std::string>& args) {
     std::ostringstream ss;
     ss << "*" << args.size() << "\r\n";
@@ -168,7 +394,11 @@ int RedisClient::connect_tcp(const std::string& host, int port) {
     for (auto p = res; p != nullptr; p = p->ai_next) {
         fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
         if (fd < 0) continue;
-        if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+        if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+            const int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
         ::close(fd);
         fd = -1;
     }
@@ -176,23 +406,96 @@ int RedisClient::connect_tcp(const std::string& host, int port) {
     return fd;
 }
 
-std::optional<RedisClient::Resp> RedisClient::cmd(const std::vector<std::string>& args) {
-    std::lock_guard<std::mutex> lk(mtx_);
-    int fd = connect_tcp(host_, port_);
-    if (fd < 0) return std::nullopt;
+int RedisClient::acquire(bool* reused) {
+    static Counter& timeouts =
+        MetricsRegistry::instance().counter("tg_redis_pool_timeouts_total", "Redis commands that found no free connection in time");
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (true) {
+        if (!pool_cv_.wait_for(lk, acquire_timeout_, [this] { return !idle_.empty() || open_ < pool_max_; })) {
+            timeouts.inc();
+            return -1;
+        }
+        if (idle_.empty()) break;
+        const int fd = idle_.back();
+        idle_.pop_back();
+        // Nothing is owed on an idle connection; anything readable is the
+        // server's EOF or reset, so drop it rather than send into it.
+        pollfd p{fd, POLLIN, 0};
+        if (::poll(&p, 1, 0) == 0) {
+            *reused = true;
+            return fd;
+        }
+        ::close(fd);
+        --open_;
+        open_connections().set(static_cast<double>(open_));
+    }
+    ++open_;
+    lk.unlock();
+    *reused = false;
+    const int fd = connect_tcp(host_, port_);
+    lk.lock();
+    if (fd < 0) {
+        --open_;
+        pool_cv_.notify_one();
+    }
+    open_connections().set(static_cast<double>(open_));
+    return fd;
+}
 
-    std::string payload = encode(args);
-    std::size_t sent = 0;
-    while (sent < payload.size()) {
-        ssize_t w = ::send(fd, payload.data() + sent, payload.size() - sent, 0);
-        if (w <= 0) {
+void RedisClient::release(int fd, bool healthy) {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (healthy) {
+            idle_.push_back(fd);
+        } else {
             ::close(fd);
-            return std::nullopt;
+            --open_;
+            open_connections().set(static_cast<double>(open_));
         }
+    }
+    pool_cv_.notify_one();
+}
+
+bool RedisClient::send_all(int fd, const std::string& payload) {
+    std::size_t sent = 0;
+    while (sent < payload.size()) {
+        ssize_t w = ::send(fd, payload.data() + sent, payload.size() - sent, MSG_NOSIGNAL);
+        if (w <= 0) return false;
         sent += static_cast<std::size_t>(w);
     }
+    return true;
+}
 
-    auto resp = parse_resp(fd);
-    ::close(fd);
-    return resp;
+std::optional<RedisClient::Resp> RedisClient::cmd(const std::vector<std::string>& args) {
+    static Counter& errors = MetricsRegistry::instance().counter("tg_redis_errors_total", "Redis commands that failed at the transport level");
+    static const std::string kNoCommand;
+    const std::string& name = args.empty() ? kNoCommand : args[0];
+    ScopedTimer timer(command_latency(name));
+    Span span("redis", name);
+
+    const std::string payload = encode(args);
+    // A pooled connection may have been closed by the server while idle; that
+    // shows up on first use, so retry once on a fresh one. A command that was
+    // sent may have run even though its reply was lost, so after a failed read
+    // only read-only commands are sent again.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused = false;
+        const int fd = acquire(&reused);
+        if (fd < 0) break;
+        if (!send_all(fd, payload)) {
+            release(fd, false);
+            if (reused) continue;
+            break;
+        }
+        std::optional<Resp> resp;
+        try {
+            resp = parse_resp(fd);
+        } catch (...) {
+        }
+        release(fd, resp.has_value());
+        if (resp) return resp;
+        if (!reused || !read_only(name)) break;
+    }
+    errors.inc();
+    return std::nullopt;
 }
@@ -0,0 +1,262 @@
+#include "request_executor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "util.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+Counter& retries_total() {
+    static Counter& c = MetricsRegistry::instance().counter("tg_main_retries_total", "Main backend calls replayed after a transient failure");
+    return c;
+}
+
+bool transient(const cpr::Response& r) {
+    return r.status_code == 0 || r.status_code == 502 || r.status_code == 503 || r.status_code == 504;
+}
+
+// The request never reached the server, so replaying it is safe for any verb.
+bool not_sent(const cpr::Response& r) {
+    return r.status_code == 0 && r.error.code == cpr::ErrorCode::CONNECTION_FAILURE;
+}
+
+// Full jitter: uniform in [0, base * 2^attempt], capped at 5 s.
+void backoff(std::int32_t base_ms, int attempt) {
+    thread_local std::mt19937 rng{std::random_device{}()};
+    const std::int64_t ceiling = std::min<std::int64_t>(5000, static_cast<std::int64_t>(base_ms) << std::min(attempt, 16));
+    std::uniform_int_distribution<std::int64_t> dist(0, std::max<std::int64_t>(ceiling, 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(dist(rng)));
+}
+
+bool apply_identity(const std::shared_ptr<const json>& me, Session& s) {
+    if (!me || !me->is_object()) return false;
+    try {
+        const int id = me->value("id", -1);
+        if (id < 0) return false;
+        s.user_id = id;
+        // A missing, null or non-string role leaves the backend to decide.
+        auto role = me->find("role");
+        s.role = role != me->end() && role->is_string() ? role->get<std::string>() : std::string{};
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool always() { return true; }
+bool never() { return false; }
+
+std::int32_t env_ms(const char* key, const char* def) {
+    return static_cast<std::int32_t>(std::stoi(getenv_or(key, def)));
+}
+
+} // namespace
+
+RequestExecutor::RequestExecutor(MainClient& main, AuthClient& auth, std::shared_ptr<SessionStore> store)
+    : main_(main),
+      auth_(auth),
+      store_(std::move(store)),
+      defaults_{env_ms("TG_HTTP_TIMEOUT_MS", "5000"), env_ms("TG_HTTP_CONNECT_TIMEOUT_MS", "1000")},
+      retries_(std::max(0, std::stoi(getenv_or("TG_HTTP_RETRIES", "2")))),
+      backoff_ms_(env_ms("TG_HTTP_BACKOFF_MS", "100")),
+      hedge_ms_(env_ms("TG_HTTP_HEDGE_MS", "0")) {
+    const std::string spec = getenv_or("TG_HTTP_TIMEOUTS", "");
+    FieldSplitter entries(spec, ',');
+    std::string_view entry;
+    while (entries.next(entry)) {
+        auto kv = split_by_view<2>(trim_view(entry), '=');
+        int ms = 0;
+        if (kv.size() == 2 && !trim_view(kv[0]).empty() && parse_int(trim_view(kv[1]), &ms)) {
+            timeouts_.emplace_back(std::string(trim_view(kv[0])), ms);
+        }
+    }
+    // Longest prefix first so the first match is the most specific.
+    std::sort(timeouts_.begin(), timeouts_.end(), [](const auto& a, const auto& b) { return a.first.size() > b.first.size(); });
+    if (hedge_ms_ > 0) {
+        hedges_.start(static_cast<std::size_t>(std::max(2, std::stoi(getenv_or("TG_HTTP_HEDGE_THREADS", "8")))));
+    }
+}
+
+void RequestExecutor::shutdown() {
+    hedges_.stop();
+}
+
+CallLimits RequestExecutor::limits_for(const std::string& path) const {
+    CallLimits l = defaults_;
+    for (const auto& [prefix, ms] : timeouts_) {
+        if (starts_with(path, prefix)) {
+            l.timeout_ms = ms;
+            break;
+        }
+    }
+    return l;
+}
+
+bool RequestExecutor::refresh(Session& s) {
+    static Counter& refreshes =
+        MetricsRegistry::instance().counter("tg_token_refreshes_total", "Access tokens refreshed after a 401");
+    if (s.refresh_token.empty()) return false;
+    auto t = auth_.refresh(s.refresh_token);
+    if (!t) return false;
+    refreshes.inc();
+    s.access_token = t->first;
+    s.refresh_token = t->second;
+    // Picks up role changes; a failure keeps the identity we had.
+    auto me = main_.get_json("/api/users/me", s.access_token, limits_for("/api/users/me"));
+    if (me.response.status_code == 200) apply_identity(me.body, s);
+    return true;
+}
+
+int RequestExecutor::identify(std::int64_t chatId, Session& s) {
+    auto me = get_json(chatId, s, "/api/users/me");
+    if (me.response.status_code != 200) return static_cast<int>(me.response.status_code);
+    return apply_identity(me.body, s) ? 200 : -1;
+}
+
+template <typename Call>
+cpr::Response RequestExecutor::execute(std::int64_t chatId,
+                                       Session& s,
+                                       const std::function<bool()>& replay,
+                                       Call&& call) {
+    bool refreshed = false;
+    int attempt = 0;
+    while (true) {
+        cpr::Response r = call(s.access_token);
+        if (r.status_code == 401 && !refreshed) {
+            refreshed = true;
+            if (!refresh(s)) return r;
+            store_->save(chatId, s);
+            continue;
+        }
+        const bool retry = replay() ? transient(r) : not_sent(r);
+        // Backing off only to be turned away again would just hold the caller.
+        if (!retry || attempt >= retries_ || main_.breaker().rejecting()) return r;
+        retries_total().inc();
+        backoff(backoff_ms_, attempt++);
+    }
+}
+
+MainClient::JsonGet RequestExecutor::hedged_get(const std::string& path,
+                                                const std::string& bearer,
+                                                const CallLimits& limits,
+                                                bool parse) {
+    static Counter& hedges =
+        MetricsRegistry::instance().counter("tg_main_hedged_total", "GETs that got a second, hedged request");
+
+    // Shared with the pool tasks, which may outlive this call.
+    struct Race {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::optional<MainClient::JsonGet> good;
+        std::optional<MainClient::JsonGet> last;
+        int done{0};
+    };
+    auto race = std::make_shared<Race>();
+    auto launch = [this, race, path, bearer, limits, parse]() {
+        hedges_.post([this, race, path, bearer, limits, parse]() {
+            auto r = parse ? main_.get_json(path, bearer, limits) : MainClient::JsonGet{main_.get(path, bearer, limits), nullptr};
+            std::lock_guard<std::mutex> lk(race->mtx);
+            race->done++;
+            if (!transient(r.response) && !race->good) {
+                race->good = std::move(r);
+            } else {
+                race->last = std::move(r);
+            }
+            race->cv.notify_all();
+        });
+    };
+
+    // The requests run without this thread's trace and flight draft, which
+    // must not be written from two threads or after this call returns; the
+    // wait is recorded here instead.
+    Span span("main.GET", path);
+    FlightPhase phase(FlightRecorder::Phase::BACKEND);
+    launch();
+    int launched = 1;
+    std::unique_lock<std::mutex> lk(race->mtx);
+    if (!race->cv.wait_for(lk, std::chrono::milliseconds(hedge_ms_), [&] { return race->done > 0; })) {
+        // Once the pool is stopping the hedge runs inline, and takes the lock.
+        lk.unlock();
+        launch();
+        lk.lock();
+        launched = 2;
+        hedges.inc();
+    }
+    race->cv.wait(lk, [&] { return race->good.has_value() || race->done >= launched; });
+    return race->good ? *race->good : *race->last;
+}
+
+cpr::Response RequestExecutor::get(std::int64_t chatId, Session& s, const std::string& path) {
+    const CallLimits limits = limits_for(path);
+    return execute(chatId, s, always, [&](const std::string& bearer) {
+        return hedge_ms_ > 0 ? hedged_get(path, bearer, limits, false).response : main_.get(path, bearer, limits);
+    });
+}
+
+MainClient::JsonGet RequestExecutor::get_json(std::int64_t chatId, Session& s, const std::string& path) {
+    const CallLimits limits = limits_for(path);
+    std::shared_ptr<const json> body;
+    auto r = execute(chatId, s, always, [&](const std::string& bearer) {
+        auto g = hedge_ms_ > 0 ? hedged_get(path, bearer, limits, true) : main_.get_json(path, bearer, limits);
+        body = std::move(g.body);
+        return std::move(g.response);
+    });
+    return {std::move(r), std::move(body)};
+}
+
+cpr::Response RequestExecutor::get_stream(std::int64_t chatId,
+                                          Session& s,
+                                          const std::string& path,
+                                          const std::function<bool(std::string_view)>& on_data,
+                                          const std::function<void()>& on_restart) {
+    const CallLimits limits = limits_for(path);
+    bool delivered = false;
+    bool started = false;
+    const auto feed = [&](std::string_view data) {
+        delivered = true;
+        return on_data(data);
+    };
+    // A 401 body is an error object the consumer skips, so replaying after a
+    // refresh is always fine; transient failures only before any data went through.
+    return execute(chatId, s, [&] { return !delivered; }, [&](const std::string& bearer) {
+        if (started) on_restart();
+        started = true;
+        delivered = false;
+        return main_.get_stream(path, bearer, feed, limits);
+    });
+}
+
+cpr::Response RequestExecutor::del(std::int64_t chatId, Session& s, const std::string& path) {
+    const CallLimits limits = limits_for(path);
+    return execute(chatId, s, always, [&](const std::string& bearer) { return main_.del(path, bearer, limits); });
+}
+
+cpr::Response RequestExecutor::post(std::int64_t chatId, Session& s, const std::string& path, const json* body) {
+    const CallLimits limits = limits_for(path);
+    return execute(chatId, s, never, [&](const std::string& bearer) { return main_.post(path, bearer, body, limits); });
+}
+
+cpr::Response RequestExecutor::post_params(std::int64_t chatId,
+                                           Session& s,
+                                           const std::string& path,
+                                           const cpr::Parameters& params) {
+    const CallLimits limits = limits_for(path);
+    return execute(
+        chatId, s, never, [&](const std::string& bearer) { return main_.post_params(path, bearer, params, limits); });
+}
+
+cpr::Response RequestExecutor::patch(std::int64_t chatId, Session& s, const std::string& path, const json& body) {
+    const CallLimits limits = limits_for(path);
+    return execute(chatId, s, never, [&](const std::string& bearer) { return main_.patch(path, bearer, body, limits); });
+}
@@ -0,0 +1,80 @@
+#include "response_cache.h"
+
+#include <functional>
+
+#include "metrics.h"
+
+namespace {
+
+Gauge& entries_gauge() {
+    static Gauge& g = MetricsRegistry::instance().gauge("tg_main_cache_entries", "Main backend responses held for revalidation");
+    return g;
+}
+
+} // namespace
+
+ResponseCache::Entry::Entry(std::string etag_in, std::string last_modified_in, std::string body_in)
+    : etag(std::move(etag_in)), last_modified(std::move(last_modified_in)), body(std::move(body_in)) {}
+
+std::shared_ptr<const nlohmann::json> ResponseCache::Entry::json() const {
+    std::call_once(parse_once_, [this] {
+        try {
+            parsed_ = std::make_shared<const nlohmann::json>(nlohmann::json::parse(body));
+        } catch (...) {
+        }
+    });
+    return parsed_;
+}
+
+ResponseCache::ResponseCache(std::size_t max_entries, std::size_t max_body)
+    : max_entries_(max_entries), max_body_(max_body) {}
+
+std::string ResponseCache::key(std::string_view scope, std::string_view path) {
+    std::string k = std::to_string(std::hash<std::string_view>{}(scope));
+    k += ' ';
+    k += path;
+    return k;
+}
+
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::find(const std::string& key) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = index_.find(key);
+    if (it == index_.end()) return nullptr;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+}
+
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::put(const std::string& key,
+                                                               std::string etag,
+                                                               std::string last_modified,
+                                                               std::string body) {
+    if (!enabled() || (etag.empty() && last_modified.empty()) || body.size() > max_body_) {
+        erase(key);
+        return nullptr;
+    }
+    auto e = std::make_shared<const Entry>(std::move(etag), std::move(last_modified), std::move(body));
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->second = e;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return e;
+    }
+    lru_.emplace_front(key, e);
+    index_.emplace(key, lru_.begin());
+    while (lru_.size() > max_entries_) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    entries_gauge().set(static_cast<double>(lru_.size()));
+    return e;
+}
+
+void ResponseCache::erase(const std::string& key) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = index_.find(key);
+    if (it == index_.end()) return;
+    lru_.erase(it->second);
+    index_.erase(it);
+    entries_gauge().set(static_cast<double>(lru_.size()));
+}
@@ -23,10 +23,13 @@ json session_to_json(const Session& s) {
                 {"login_type", s.login_type},
                 {"access_token", s.access_token},
                 {"refresh_token", s.refresh_token},
+                {"user_id", s.user_id},
+                {"role", s.role},
                 {"current_course_id", s.current_course_id},
                 {"current_test_id", s.current_test_id},
                 {"current_attempt_id", s.current_attempt_id},
-                {"current_answer_index", s.current_answer_index}};
+                {"current_answer_index", s.current_answer_index},
+                {"question_message_id", s.question_message_id}};
 }
 
 Session session_from_json(const json& j) {
@@ -36,9 +39,12 @@ Session session_from_json(const json& j) {
     s.login_type = j.value("login_type", "");
     s.access_token = j.value("access_token", "");
     s.refresh_token = j.value("refresh_token", "");
+    s.user_id = j.value("user_id", -1);
+    s.role = j.value("role", "");
     s.current_course_id = j.value("current_course_id", -1);
     s.current_test_id = j.value("current_test_id", -1);
     s.current_attempt_id = j.value("current_attempt_id", -1);
     s.current_answer_index = j.value("current_answer_index", 0);
+    s.question_message_id = j.value("question_message_id", 0);
     return s;
 }
@@ -4,6 +4,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include "flight_recorder.h"
+#include "tracing.h"
 #include "util.h"
 
 SessionStore::SessionStore(std::shared_ptr<RedisClient> redis)
@@ -14,6 +16,8 @@ std::string SessionStore::key_for_chat(std::int64_t chatId) const {
 }
 
 Session SessionStore::load(std::int64_t chatId) {
+    Span span("session.load");
+    FlightPhase phase(FlightRecorder::Phase::LOAD);
     auto raw = redis_->get(key_for_chat(chatId));
     if (!raw) return Session{};
     try {
@@ -24,6 +28,8 @@ Session SessionStore::load(std::int64_t chatId) {
 }
 
 void SessionStore::save(std::int64_t chatId, const Session& s, int ttlSeconds) {
+    Span span("session.save");
+    FlightPhase phase(FlightRecorder::Phase::LOAD);
     redis_->set(key_for_chat(chatId), session_to_json(s).dump(), ttlSeconds);
 }
 
@@ -43,9 +49,11 @@ void SessionStore::mark_auth(std::int64_t chatId) {
     redis_->srem(prefix_ + ":anon", std::to_string(chatId));
 }
 
-std::vector<std::int64_t> SessionStore::anon_chats() {
+std::vector<std::int64_t> SessionStore::scan_chats(ChatSet set, std::string* cursor, std::size_t count) {
     std::vector<std::int64_t> out;
-    for (auto& s : redis_->smembers(prefix_ + ":anon")) {
+    const auto members = redis_->sscan(prefix_ + (set == ChatSet::ANON ? ":anon" : ":auth"), cursor, count);
+    out.reserve(members.size());
+    for (auto& s : members) {
         try {
             out.push_back(std::stoll(s));
         } catch (...) {
@@ -54,11 +62,21 @@ std::vector<std::int64_t> SessionStore::anon_chats() {
     return out;
 }
 
-std::vector<std::int64_t> SessionStore::auth_chats() {
-    std::vector<std::int64_t> out;
-    for (auto& s : redis_->smembers(prefix_ + ":auth")) {
+std::vector<Session> SessionStore::load_many(const std::vector<std::int64_t>& chatIds) {
+    Span span("session.load_many");
+    FlightPhase phase(FlightRecorder::Phase::LOAD);
+    std::vector<Session> out;
+    if (chatIds.empty()) return out;
+    std::vector<std::string> keys;
+    keys.reserve(chatIds.size());
+    for (auto chatId : chatIds) keys.push_back(key_for_chat(chatId));
+    auto raws = redis_->mget(keys);
+    if (raws.size() != chatIds.size()) return out;
+    out.resize(raws.size());
+    for (std::size_t i = 0; i < raws.size(); ++i) {
+        if (!raws[i]) continue;
         try {
-            out.push_back(std::stoll(s));
+            out[i] = session_from_json(nlohmann::json::parse(*raws[i]));
         } catch (...) {
         }
     }
@@ -1,48 +1,83 @@
 #include "telegram_bot.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <future>
 #include <iostream>
+#include <latch>
+#include <optional>
+#include <random>
 #include <set>
-#include <sstream>
+#include <stdexcept>
 #include <thread>
+#include <unordered_set>
 
 #include <nlohmann/json.hpp>
 
+#include "keyboard.h"
+#include "flight_recorder.h"
+#include "metrics.h"
 #include "session.h"
+#include "tracing.h"
+#include "update_arena.h"
+#include "update_capture.h"
 #include "util.h"
 
 using json = nlohmann::json;
 
 namespace {
 
-std::string command_payload(const std::string& text) {
-    auto pos = text.find(' ');
-    if (pos == std::string::npos) return {};
-    return trim(text.substr(pos + 1));
+// Attempt plans kept for batched answers; the least recently used go first.
+constexpr std::size_t kMaxPlans = 10000;
+
+struct HandlerMetrics {
+    Counter* calls;
+    Histogram* latency;
+};
+
+HandlerMetrics handler_metrics(const std::string& handler) {
+    auto& reg = MetricsRegistry::instance();
+    const auto label = metric_label("handler", handler);
+    return {&reg.counter("tg_updates_total", "Updates handled, by handler", label),
+            &reg.histogram("tg_handler_seconds", "Handler wall time, by handler", label)};
 }
 
-bool parse_bool_flag(const std::string& s, bool* out) {
-    if (s == "1" || s == "true" || s == "yes") {
-        *out = true;
-        return true;
-    }
-    if (s == "0" || s == "false" || s == "no") {
-        *out = false;
-        return true;
-    }
-    return false;
+std::chrono::milliseconds callback_dedup_ttl() {
+    return std::chrono::seconds(std::stoi(getenv_or("TG_CALLBACK_DEDUP_SEC", "60")));
 }
 
-bool parse_int(const std::string& s, int* out) {
-    try {
-        std::size_t idx = 0;
-        int v = std::stoi(s, &idx);
-        if (idx != s.size()) return false;
-        *out = v;
-        return true;
-    } catch (...) {
-        return false;
-    }
+std::string answer_key(std::int64_t chatId, int answer_id) {
+    return "a:" + std::to_string(chatId) + ":" + std::to_string(answer_id);
+}
+
+Counter& sweeps_skipped(const std::string& sweep) {
+    return MetricsRegistry::instance().counter(
+        "tg_sweeps_skipped_total", "Background sweeps skipped or cut short by an open circuit", metric_label("sweep", sweep));
+}
+
+// A random duration in [lo, hi) times `base`, so replicas started together do
+// not sweep in lockstep.
+std::chrono::milliseconds jittered(std::chrono::milliseconds base, double lo, double hi) {
+    thread_local std::mt19937 rng{std::random_device{}()};
+    std::uniform_real_distribution<double> f(lo, hi);
+    return std::chrono::milliseconds(static_cast<std::int64_t>(static_cast<double>(base.count()) * f(rng)));
+}
+
+// A string member as a view into `j`; empty when missing or not a string.
+std::string_view str_field(const json& j, const char* key) {
+    auto it = j.find(key);
+    if (it == j.end() || !it->is_string()) return {};
+    return it->get_ref<const std::string&>();
+}
+
+bool env_flag(const char* key) {
+    bool on = false;
+    return parse_bool_flag(getenv_or(key, "0"), &on) && on;
+}
+
+std::size_t sweep_page_size() {
+    return static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_SWEEP_PAGE", "200"))));
 }
 
 std::string help_text() {
@@ -73,47 +108,210 @@ std::string help_text() {
            "/help - помощь\n";
 }
 
+// TG_ADMIN_ROLES: comma-separated roles allowed admin commands; "" = any role.
+bool is_admin_role(const std::string& role) {
+    static const std::vector<std::string> roles = [] {
+        std::vector<std::string> out;
+        const std::string spec = getenv_or("TG_ADMIN_ROLES", "admin");
+        FieldSplitter fields(spec, ',');
+        std::string_view f;
+        while (fields.next(f)) {
+            if (!trim_view(f).empty()) out.emplace_back(trim_view(f));
+        }
+        return out;
+    }();
+    return roles.empty() || std::find(roles.begin(), roles.end(), role) != roles.end();
+}
+
 } // namespace
 
 TelegramModuleBot::TelegramModuleBot(std::string token,
                                      std::shared_ptr<SessionStore> store,
                                      AuthClient auth,
                                      MainClient main)
-    : bot_(std::move(token)), store_(std::move(store)), auth_(std::move(auth)), main_(std::move(main)) {
+    : bot_(std::move(token)),
+      store_(std::move(store)),
+      auth_(std::move(auth)),
+      main_(std::move(main)),
+      requests_(main_, auth_, store_),
+      keyboards_(static_cast<std::size_t>(std::max(0, std::stoi(getenv_or("TG_KEYBOARD_CACHE", "1024"))))),
+      seen_callbacks_(callback_dedup_ttl(), 100000),
+      limiter_(store_->redis(), store_->prefix()),
+      cluster_(store_->redis(), store_->prefix()),
+      outbox_(store_->redis(), store_->prefix(), cluster_.id()),
+      batch_answers_(env_flag("TG_BATCH_ANSWERS")),
+      answer_batch_(std::max(1, std::stoi(getenv_or("TG_ANSWER_BATCH", "10")))),
+      answer_log_(store_->redis(), store_->prefix()),
+      drain_timeout_(std::max(1, std::stoi(getenv_or("TG_DRAIN_TIMEOUT_SEC", "25")))) {
     setup_handlers();
 }
 
+TelegramModuleBot::TelegramModuleBot(std::string token,
+                                     std::shared_ptr<SessionStore> store,
+                                     AuthClient auth,
+                                     MainClient main,
+                                     const TgBot::HttpClient& http)
+    : bot_(std::move(token), http),
+      store_(std::move(store)),
+      auth_(std::move(auth)),
+      main_(std::move(main)),
+      requests_(main_, auth_, store_),
+      keyboards_(static_cast<std::size_t>(std::max(0, std::stoi(getenv_or("TG_KEYBOARD_CACHE", "1024"))))),
+      seen_callbacks_(callback_dedup_ttl(), 100000),
+      limiter_(store_->redis(), store_->prefix()),
+      cluster_(store_->redis(), store_->prefix()),
+      outbox_(store_->redis(), store_->prefix(), cluster_.id()),
+      batch_answers_(env_flag("TG_BATCH_ANSWERS")),
+      answer_batch_(std::max(1, std::stoi(getenv_or("TG_ANSWER_BATCH", "10")))),
+      answer_log_(store_->redis(), store_->prefix()),
+      drain_timeout_(std::max(1, std::stoi(getenv_or("TG_DRAIN_TIMEOUT_SEC", "25")))) {
+    setup_handlers();
+}
+
+void TelegramModuleBot::process_update(const TgBot::Update::Ptr& update) {
+    bot_.getEventHandler().handleUpdate(update);
+}
+
+bool TelegramModuleBot::warm_up() {
+    const std::int32_t timeout_ms = std::max(100, std::stoi(getenv_or("TG_STARTUP_PROBE_MS", "3000")));
+    const auto started = std::chrono::steady_clock::now();
+
+    auto redis = std::async(std::launch::async, [this] {
+        return store_->ping() && store_->redis()->warm(store_->redis()->pool_size()) > 0;
+    });
+    auto auth = std::async(std::launch::async, [this, timeout_ms] { return auth_.reachable(timeout_ms); });
+    auto main = std::async(std::launch::async, [this, timeout_ms] { return main_.reachable(timeout_ms); });
+    auto telegram = std::async(std::launch::async, [this] {
+        try {
+            return bot_.getApi().getMe() != nullptr;
+        } catch (...) {
+            return false;
+        }
+    });
+
+    bool redis_ok = false;
+    const std::pair<const char*, std::future<bool>*> probes[] = {
+        {"redis", &redis}, {"auth", &auth}, {"main", &main}, {"telegram", &telegram}};
+    for (const auto& [name, probe] : probes) {
+        const bool up = probe->get();
+        MetricsRegistry::instance()
+            .gauge("tg_upstream_up", "Upstreams reachable at startup", metric_label("upstream", name))
+            .set(up ? 1 : 0);
+        if (!up) std::cerr << "startup: " << name << " is not reachable" << std::endl;
+        if (probe == &redis) redis_ok = up;
+    }
+    std::cout << "startup checks took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+              << " ms" << std::endl;
+    return redis_ok;
+}
+
 void TelegramModuleBot::run() {
     std::cout << "TG bot started" << std::endl;
+    cluster_.start();
     start_auth_poll_thread();
     start_notification_thread();
+    start_outbox_thread();
+    if (batch_answers_) start_answer_flush_thread();
+    dispatcher_.start(static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_WORKERS", "8")))));
+    io_.start(static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_IO_THREADS", "16")))));
     TgBot::TgLongPoll poll(bot_);
-    while (true) {
+    while (!stop_.stop_requested()) {
         poll.start();
     }
+    shutdown();
 }
 
-void TelegramModuleBot::safe_send(std::int64_t chatId,
+void TelegramModuleBot::request_stop() {
+    // The long poll may not return for a while yet; the drain budget starts now.
+    if (stop_.stop_requested()) return;
+    drain_deadline_ = std::chrono::steady_clock::now() + drain_timeout_;
+    stop_.request_stop();
+}
+
+void TelegramModuleBot::shutdown() {
+    std::cout << "TG bot draining" << std::endl;
+    const auto deadline = stop_.stop_requested() ? drain_deadline_ : std::chrono::steady_clock::now() + drain_timeout_;
+    // Handlers finish their Redis saves as part of the drain; sessions are
+    // never held only in memory.
+    if (!dispatcher_.drain(deadline)) {
+        std::cerr << "drain deadline passed with updates still in flight" << std::endl;
+    }
+    io_.stop();
+    dispatcher_.stop();
+    requests_.shutdown();
+    for (auto& t : background_) t.join();
+    background_.clear();
+    cluster_.stop();
+    std::cout << "TG bot stopped" << std::endl;
+}
+
+std::int32_t TelegramModuleBot::safe_send(std::int64_t chatId,
+                                          const std::string& text,
+                                          TgBot::InlineKeyboardMarkup::Ptr kb,
+                                          bool* undeliverable) {
+    static Histogram& latency = MetricsRegistry::instance().histogram(
+        "tg_telegram_request_seconds", "Telegram Bot API call time, by method", metric_label("method", "sendMessage"));
+    static Counter& errors =
+        MetricsRegistry::instance().counter("tg_telegram_send_errors_total", "sendMessage calls that threw");
+    try {
+        std::lock_guard<std::mutex> lk(send_mtx_);
+        ScopedTimer timer(latency);
+        Span span("telegram.sendMessage");
+        FlightPhase phase(FlightRecorder::Phase::SEND);
+
+        auto sent = bot_.getApi().sendMessage(chatId,
+                                              text,
+                                              nullptr,
+                                              nullptr,
+                                              kb,
+                                              std::string{},
+                                              false,
+                                              std::vector<TgBot::MessageEntity::Ptr>{},
+                                              0,
+                                              false);
+        return sent ? sent->messageId : 0;
+    } catch (const TgBot::TgException& e) {
+        errors.inc();
+        const std::string_view what(e.what());
+        if (undeliverable && (what.find("Forbidden") != std::string_view::npos ||
+                              what.find("Bad Request") != std::string_view::npos)) {
+            *undeliverable = true;
+        }
+    } catch (...) {
+        errors.inc();
+    }
+    return 0;
+}
+
+bool TelegramModuleBot::safe_edit(std::int64_t chatId,
+                                  std::int32_t messageId,
                                   const std::string& text,
                                   TgBot::InlineKeyboardMarkup::Ptr kb) {
+    static Histogram& latency = MetricsRegistry::instance().histogram(
+        "tg_telegram_request_seconds", "Telegram Bot API call time, by method", metric_label("method", "editMessageText"));
+    static Counter& errors =
+        MetricsRegistry::instance().counter("tg_telegram_edit_errors_total", "editMessageText calls that threw");
     try {
         std::lock_guard<std::mutex> lk(send_mtx_);
+        ScopedTimer timer(latency);
+        Span span("telegram.editMessageText");
+        FlightPhase phase(FlightRecorder::Phase::SEND);
 
-        bot_.getApi().sendMessage(chatId,
-                                  text,
-                                  nullptr,
-                                  nullptr,
-                                  kb,
-                                  std::string{},
-                                  false,
-                                  std::vector<TgBot::MessageEntity::Ptr>{},
-                                  0,
-                                  false);
+        bot_.getApi().editMessageText(text, chatId, messageId, std::string{}, std::string{}, nullptr, kb);
+        return true;
+    } catch (const TgBot::TgException& e) {
+        // A repeated tap re-renders identical content; the message is already right.
+        if (std::string_view(e.what()).find("message is not modified") != std::string_view::npos) return true;
+        errors.inc();
     } catch (...) {
+        errors.inc();
     }
+    return false;
 }
 
 bool TelegramModuleBot::ensure_auth(std::int64_t chatId, Session& s) {
+    Span span("ensure_auth");
     if (s.status == SessionStatus::AUTH && !s.access_token.empty() && !s.refresh_token.empty()) return true;
 
     if (s.status == SessionStatus::ANON && !s.token_in.empty()) {
@@ -124,6 +322,7 @@ bool TelegramModuleBot::ensure_auth(std::int64_t chatId, Session& s) {
             s.access_token = cr.access;
             s.refresh_token = cr.refresh;
             s.token_in.clear();
+            requests_.identify(chatId, s);
 
             store_->save(chatId, s);
             store_->mark_auth(chatId);
@@ -145,17 +344,206 @@ bool TelegramModuleBot::ensure_auth(std::int64_t chatId, Session& s) {
     return false;
 }
 
-bool TelegramModuleBot::refresh_if_needed(Session& s) {
-    if (s.refresh_token.empty()) return false;
-    auto t = auth_.refresh(s.refresh_token);
-    if (!t) return false;
-    s.access_token = t->first;
-    s.refresh_token = t->second;
+bool TelegramModuleBot::ensure_identity(std::int64_t chatId, Session& s) {
+    if (s.user_id >= 0) return true;
+    const int http = requests_.identify(chatId, s);
+    if (http == 200) {
+        store_->save(chatId, s);
+        return true;
+    }
+    if (http == 403) {
+        safe_send(chatId, "У вас нет разрешения на это действие.");
+    } else if (http < 0) {
+        safe_send(chatId, "Не удалось определить user_id.");
+    } else {
+        safe_send(chatId, "Не удалось получить пользователя (HTTP " + std::to_string(http) + ")");
+    }
+    return false;
+}
+
+bool TelegramModuleBot::ensure_admin(std::int64_t chatId, Session& s) {
+    static Counter& denied =
+        MetricsRegistry::instance().counter("tg_admin_denied_total", "Admin commands refused from the cached role");
+    // Sessions from before identity tracking learn it here; if that fails the backend decides.
+    if (s.user_id < 0 && requests_.identify(chatId, s) == 200) store_->save(chatId, s);
+    if (s.role.empty() || is_admin_role(s.role)) return true;
+    denied.inc();
+    safe_send(chatId, "У вас нет разрешения на это действие.");
+    return false;
+}
+
+cpr::Response TelegramModuleBot::get_array(std::int64_t chatId,
+                                           Session& s,
+                                           const std::string& path,
+                                           JsonArrayStream& parser) {
+    return requests_.get_stream(
+        chatId, s, path, [&parser](std::string_view data) { return parser.feed(data); }, [&parser] { parser.reset(); });
+}
+
+const CircuitBreaker* TelegramModuleBot::breaker_for(const std::string& command) const {
+    if (command == "start" || command == "help") return nullptr;
+    if (command == "login" || command == "logout") return &auth_.breaker();
+    return &main_.breaker();
+}
+
+void TelegramModuleBot::notify(std::int64_t chatId, const char* text) {
+    // Off the polling thread: a slow Bot API call here would hold up every chat's updates.
+    io_.post([this, chatId, text]() { safe_send(chatId, text); });
+}
+
+void TelegramModuleBot::acknowledge(const std::string& queryId, const char* text) {
+    io_.post([this, queryId, text]() {
+        try {
+            if (text) {
+                bot_.getApi().answerCallbackQuery(queryId, text);
+            } else {
+                bot_.getApi().answerCallbackQuery(queryId);
+            }
+        } catch (...) {
+        }
+    });
+}
+
+bool TelegramModuleBot::shed(std::int64_t chatId, const CircuitBreaker* breaker) {
+    static Counter& shed_total =
+        MetricsRegistry::instance().counter("tg_shed_updates_total", "Updates answered without work while an upstream is down");
+    if (!breaker || !breaker->rejecting()) return false;
+    shed_total.inc();
+    notify(chatId, "⏳ Сервис временно недоступен. Попробуй ещё раз через минуту.");
     return true;
 }
 
+bool TelegramModuleBot::admitted(std::int64_t chatId, RateLimiter::Class c) {
+    switch (limiter_.admit(chatId, c)) {
+        case RateLimiter::Verdict::ADMIT: return true;
+        case RateLimiter::Verdict::REJECT:
+            notify(chatId, "⏳ Слишком много запросов. Подожди немного.");
+            return false;
+        case RateLimiter::Verdict::REJECT_QUIET: return false;
+    }
+    return false;
+}
+
+void TelegramModuleBot::on_command(const std::string& name, std::function<void(TgBot::Message::Ptr)> fn) {
+    const auto m = handler_metrics(name);
+    auto run = std::make_shared<std::function<void(TgBot::Message::Ptr)>>(std::move(fn));
+    const CircuitBreaker* breaker = breaker_for(name);
+    const auto rate_class = RateLimiter::classify(name);
+    bot_.getEvents().onCommand(name, [this, name, m, run, breaker, rate_class](TgBot::Message::Ptr msg) {
+        m.calls->inc();
+        if (!admitted(msg->chat->id, rate_class)) return;
+        if (shed(msg->chat->id, breaker)) return;
+        dispatcher_.submit(msg->chat->id, [this, name, m, run, msg, rate_class]() {
+            if (!limiter_.admit_shared(msg->chat->id, rate_class)) return;
+            ScopedTimer timer(*m.latency);
+            TraceScope trace(name.c_str(), msg->chat->id);
+            FlightScope flight(name.c_str(), msg->chat->id);
+            UpdateArena arena;
+            (*run)(msg);
+        });
+    });
+}
+
+void TelegramModuleBot::on_command_async(const std::string& name,
+                                         std::function<Task<void>(TgBot::Message::Ptr)> fn) {
+    const auto m = handler_metrics(name);
+    auto run = std::make_shared<std::function<Task<void>(TgBot::Message::Ptr)>>(std::move(fn));
+    const CircuitBreaker* breaker = breaker_for(name);
+    const auto rate_class = RateLimiter::classify(name);
+    bot_.getEvents().onCommand(name, [this, name, m, run, breaker, rate_class](TgBot::Message::Ptr msg) {
+        m.calls->inc();
+        if (!admitted(msg->chat->id, rate_class)) return;
+        if (shed(msg->chat->id, breaker)) return;
+        dispatcher_.submit_async(msg->chat->id, [this, name, m, run, msg, rate_class]() -> Task<void> {
+            if (limiter_.shared() && !co_await io_.run([&] { return limiter_.admit_shared(msg->chat->id, rate_class); })) {
+                co_return;
+            }
+            ScopedTimer timer(*m.latency);
+            TraceScope trace(name.c_str(), msg->chat->id);
+            FlightScope flight(name.c_str(), msg->chat->id);
+            UpdateArena arena;
+            co_await (*run)(msg);
+        });
+    });
+}
+
+Task<std::int32_t> TelegramModuleBot::send_async(std::int64_t chatId,
+                                                 std::string text,
+                                                 TgBot::InlineKeyboardMarkup::Ptr kb) {
+    co_return co_await io_.run([&] { return safe_send(chatId, text, kb); });
+}
+
+Task<bool> TelegramModuleBot::load_authed(std::int64_t chatId, Session& s) {
+    s = co_await io_.run([&] { return store_->load(chatId); });
+    co_return co_await io_.run([&] { return ensure_auth(chatId, s); });
+}
+
+Task<MainClient::JsonGet> TelegramModuleBot::main_get_async(std::int64_t chatId, Session& s, std::string path) {
+    co_return co_await io_.run([&] { return requests_.get_json(chatId, s, path); });
+}
+
+void TelegramModuleBot::setup_callback_handlers() {
+    auto route = [this](CallbackAction a, CallbackHandler fn, const char* name) {
+        const auto m = handler_metrics(name);
+        callback_routes_[static_cast<unsigned char>(a)] =
+            CallbackRoute{fn, nullptr, name, RateLimiter::classify(name), m.calls, m.latency};
+    };
+    auto route_async = [this](CallbackAction a, AsyncCallbackHandler fn, const char* name) {
+        const auto m = handler_metrics(name);
+        callback_routes_[static_cast<unsigned char>(a)] =
+            CallbackRoute{nullptr, fn, name, RateLimiter::classify(name), m.calls, m.latency};
+    };
+    route_async(CallbackAction::COURSE, &TelegramModuleBot::on_course_cb, "cb_course");
+    route(CallbackAction::TEST, &TelegramModuleBot::on_test_cb, "cb_test");
+    route(CallbackAction::ANSWER, &TelegramModuleBot::on_answer_cb, "cb_answer");
+    route(CallbackAction::FINISH, &TelegramModuleBot::on_finish_cb, "cb_finish");
+    route_async(CallbackAction::BACK_COURSES, &TelegramModuleBot::on_back_courses_cb, "cb_back_courses");
+    route(CallbackAction::USERS_PAGE, &TelegramModuleBot::on_users_page_cb, "cb_users_page");
+}
+
+Task<void> TelegramModuleBot::on_course_cb(std::int64_t chatId, std::int32_t, Session& s, const CallbackData& d) {
+    s.current_course_id = d.arg0;
+    co_await io_.run([&] { store_->save(chatId, s); });
+    co_await show_course_tests(chatId, s);
+}
+
+void TelegramModuleBot::on_test_cb(std::int64_t chatId, std::int32_t, Session& s, const CallbackData& d) {
+    s.current_test_id = d.arg0;
+    store_->save(chatId, s);
+    start_attempt(chatId, s);
+}
+
+void TelegramModuleBot::on_answer_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d) {
+    // One answer per question: retaps (same or another option) while the first is
+    // being processed would otherwise advance the attempt twice.
+    static Counter& duplicates =
+        MetricsRegistry::instance().counter("tg_callback_duplicates_total", "Callback queries dropped as repeats");
+    if (!seen_callbacks_.first_seen(answer_key(chatId, d.arg0))) {
+        duplicates.inc();
+        return;
+    }
+    // The tapped message is the live question, even for sessions saved before ids were tracked.
+    if (messageId != 0) s.question_message_id = messageId;
+    handle_answer(chatId, s, d.arg0, d.arg1);
+}
+
+void TelegramModuleBot::on_finish_cb(std::int64_t chatId, std::int32_t, Session& s, const CallbackData&) {
+    finish_attempt(chatId, s);
+}
+
+Task<void> TelegramModuleBot::on_back_courses_cb(std::int64_t chatId, std::int32_t, Session& s, const CallbackData&) {
+    co_await show_courses(chatId, s);
+}
+
+void TelegramModuleBot::on_users_page_cb(std::int64_t chatId, std::int32_t messageId, Session& s, const CallbackData& d) {
+    if (!ensure_admin(chatId, s)) return;
+    show_users_page(chatId, messageId, s, d.arg0);
+}
+
 void TelegramModuleBot::setup_handlers() {
-    bot_.getEvents().onCommand("start", [this](TgBot::Message::Ptr m) {
+    setup_callback_handlers();
+
+    on_command("start", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (s.status == SessionStatus::AUTH && !s.access_token.empty() && !s.refresh_token.empty()) {
             safe_send(m->chat->id, "Привет! Ты уже авторизован. /help");
@@ -168,17 +556,17 @@ void TelegramModuleBot::setup_handlers() {
         safe_send(m->chat->id, "Привет! Ты не авторизован. Используй: /login github|yandex|code\n\n/help");
     });
 
-    bot_.getEvents().onCommand("help", [this](TgBot::Message::Ptr m) {
+    on_command("help", [this](TgBot::Message::Ptr m) {
         safe_send(m->chat->id, help_text());
     });
 
-    bot_.getEvents().onCommand("login", [this](TgBot::Message::Ptr m) {
-        auto parts = split_ws(m->text);
+    on_command("login", [this](TgBot::Message::Ptr m) {
+        auto parts = split_ws_view<2>(m->text);
         if (parts.size() < 2) {
             safe_send(m->chat->id, "Использование: /login github|yandex|code");
             return;
         }
-        const std::string type = parts[1];
+        const std::string type(parts[1]);
         if (type != "github" && type != "yandex" && type != "code") {
             safe_send(m->chat->id, "Неизвестный type. Используй: github | yandex | code");
             return;
@@ -214,7 +602,7 @@ void TelegramModuleBot::setup_handlers() {
         safe_send(m->chat->id, "Не удалось начать авторизацию: " + res.error);
     });
 
-    bot_.getEvents().onCommand("logout", [this](TgBot::Message::Ptr m) {
+    on_command("logout", [this](TgBot::Message::Ptr m) {
         bool all = (m->text.find("all=true") != std::string::npos);
         Session s = store_->load(m->chat->id);
         if (!s.refresh_token.empty()) {
@@ -224,78 +612,29 @@ void TelegramModuleBot::setup_handlers() {
         safe_send(m->chat->id, "✅ Выход выполнен");
     });
 
-    bot_.getEvents().onCommand("courses", [this](TgBot::Message::Ptr m) {
-        Session s = store_->load(m->chat->id);
-        if (!ensure_auth(m->chat->id, s)) return;
-        store_->save(m->chat->id, s);
-        show_courses(m->chat->id, s);
+    on_command_async("courses", [this](TgBot::Message::Ptr m) -> Task<void> {
+        const auto chatId = m->chat->id;
+        Session s;
+        if (!co_await load_authed(chatId, s)) co_return;
+        co_await io_.run([&] { store_->save(chatId, s); });
+        co_await show_courses(chatId, s);
     });
 
-    bot_.getEvents().onCommand("users", [this](TgBot::Message::Ptr m) {
+    on_command("users", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
         store_->save(m->chat->id, s);
+        if (!ensure_admin(m->chat->id, s)) return;
 
-        auto r = main_.get("/api/users", s.access_token);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.get("/api/users", s.access_token);
-        }
-        if (r.status_code == 403) {
-            safe_send(m->chat->id, "У вас нет разрешения на это действие.");
-            return;
-        }
-        if (r.status_code == 404) {
-            safe_send(m->chat->id, "Пользователи не найдены.");
-            return;
-        }
-        if (r.status_code != 200) {
-            safe_send(m->chat->id, "Не удалось получить пользователей (HTTP " + std::to_string(r.status_code) + ")");
-            return;
-        }
-        try {
-            auto j = json::parse(r.text);
-            if (!j.is_array() || j.empty()) {
-                safe_send(m->chat->id, "Список пользователей пуст.");
-                return;
-            }
-            std::string msg = "Пользователи:\n";
-            for (auto& u : j) {
-                msg += "#" + std::to_string(u.value("id", 0)) + " ";
-                msg += u.value("username", "user");
-                auto fn = u.value("full_name", "");
-                if (!fn.empty()) msg += " (" + fn + ")";
-                msg += (u.value("is_blocked", false) ? " [blocked]" : "");
-                msg += "\n";
-            }
-            const std::size_t kMax = 3500;
-            if (msg.size() <= kMax) {
-                safe_send(m->chat->id, msg);
-                return;
-            }
-            std::string chunk;
-            chunk.reserve(kMax);
-            std::istringstream iss(msg);
-            std::string line;
-            while (std::getline(iss, line)) {
-                if (chunk.size() + line.size() + 1 > kMax) {
-                    safe_send(m->chat->id, chunk);
-                    chunk.clear();
-                }
-                chunk += line + "\n";
-            }
-            if (!chunk.empty()) safe_send(m->chat->id, chunk);
-        } catch (...) {
-            safe_send(m->chat->id, "Ошибка разбора ответа /api/users");
-        }
+        show_users_page(m->chat->id, 0, s, 0);
     });
 
-    bot_.getEvents().onCommand("ban", [this](TgBot::Message::Ptr m) {
+    on_command("ban", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
+        if (!ensure_admin(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_ws(payload);
+        auto parts = split_ws_view<1>(command_payload(m->text));
         if (parts.size() < 1) {
             safe_send(m->chat->id, "Использование: /ban <user_id>");
             return;
@@ -307,11 +646,7 @@ void TelegramModuleBot::setup_handlers() {
         }
 
         json body{{"is_blocked", true}};
-        auto r = main_.post("/api/users/" + std::to_string(user_id) + "/block", s.access_token, &body);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.post("/api/users/" + std::to_string(user_id) + "/block", s.access_token, &body);
-        }
+        auto r = requests_.post(m->chat->id, s, "/api/users/" + std::to_string(user_id) + "/block", &body);
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -320,15 +655,19 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось заблокировать пользователя (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        {
+            std::lock_guard<std::mutex> lk(users_pages_mtx_);
+            users_pages_.clear();
+        }
         safe_send(m->chat->id, "✅ Пользователь заблокирован.");
     });
 
-    bot_.getEvents().onCommand("unban", [this](TgBot::Message::Ptr m) {
+    on_command("unban", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
+        if (!ensure_admin(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_ws(payload);
+        auto parts = split_ws_view<1>(command_payload(m->text));
         if (parts.size() < 1) {
             safe_send(m->chat->id, "Использование: /unban <user_id>");
             return;
@@ -340,11 +679,7 @@ void TelegramModuleBot::setup_handlers() {
         }
 
         json body{{"is_blocked", false}};
-        auto r = main_.post("/api/users/" + std::to_string(user_id) + "/block", s.access_token, &body);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.post("/api/users/" + std::to_string(user_id) + "/block", s.access_token, &body);
-        }
+        auto r = requests_.post(m->chat->id, s, "/api/users/" + std::to_string(user_id) + "/block", &body);
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -353,52 +688,27 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось разблокировать пользователя (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        {
+            std::lock_guard<std::mutex> lk(users_pages_mtx_);
+            users_pages_.clear();
+        }
         safe_send(m->chat->id, "✅ Пользователь разблокирован.");
     });
 
-    bot_.getEvents().onCommand("set_full_name", [this](TgBot::Message::Ptr m) {
+    on_command("set_full_name", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto full_name = trim(payload);
+        const std::string full_name(command_payload(m->text));
         if (full_name.empty()) {
             safe_send(m->chat->id, "Использование: /set_full_name <full_name>");
             return;
         }
 
-        auto me = main_.get("/api/users/me", s.access_token);
-        if (me.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            me = main_.get("/api/users/me", s.access_token);
-        }
-        if (me.status_code == 403) {
-            safe_send(m->chat->id, "У вас нет разрешения на это действие.");
-            return;
-        }
-        if (me.status_code != 200) {
-            safe_send(m->chat->id, "Не удалось получить пользователя (HTTP " + std::to_string(me.status_code) + ")");
-            return;
-        }
-
-        int user_id = -1;
-        try {
-            auto j = json::parse(me.text);
-            user_id = j.value("id", -1);
-        } catch (...) {
-            user_id = -1;
-        }
-        if (user_id < 0) {
-            safe_send(m->chat->id, "Не удалось определить user_id.");
-            return;
-        }
+        if (!ensure_identity(m->chat->id, s)) return;
 
         json body{{"full_name", full_name}};
-        auto r = main_.patch("/api/users/" + std::to_string(user_id) + "/full-name", s.access_token, body);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.patch("/api/users/" + std::to_string(user_id) + "/full-name", s.access_token, body);
-        }
+        auto r = requests_.patch(m->chat->id, s, "/api/users/" + std::to_string(s.user_id) + "/full-name", body);
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -410,88 +720,64 @@ void TelegramModuleBot::setup_handlers() {
         safe_send(m->chat->id, "✅ ФИО обновлено.");
     });
 
-    bot_.getEvents().onCommand("me", [this](TgBot::Message::Ptr m) {
-        Session s = store_->load(m->chat->id);
-        if (!ensure_auth(m->chat->id, s)) return;
-        store_->save(m->chat->id, s);
-
-        auto r = main_.get("/api/users/me", s.access_token);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.get("/api/users/me", s.access_token);
-        }
-        if (r.status_code == 403) {
-            safe_send(m->chat->id, "У вас нет разрешения на это действие.");
-            return;
-        }
-        if (r.status_code != 200) {
-            safe_send(m->chat->id, "Не удалось получить пользователя (HTTP " + std::to_string(r.status_code) + ")");
-            return;
-        }
+    on_command_async("me", [this](TgBot::Message::Ptr m) -> Task<void> {
+        const auto chatId = m->chat->id;
+        Session s;
+        if (!co_await load_authed(chatId, s)) co_return;
+        co_await io_.run([&] { store_->save(chatId, s); });
 
-        int user_id = -1;
-        try {
-            auto j = json::parse(r.text);
-            user_id = j.value("id", -1);
-        } catch (...) {
-            user_id = -1;
-        }
-        if (user_id < 0) {
-            safe_send(m->chat->id, "Не удалось определить user_id.");
-            return;
-        }
+        if (!co_await io_.run([&] { return ensure_identity(chatId, s); })) co_return;
 
-        auto d = main_.get("/api/users/" + std::to_string(user_id) + "/data", s.access_token);
-        if (d.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            d = main_.get("/api/users/" + std::to_string(user_id) + "/data", s.access_token);
+        auto d = co_await main_get_async(chatId, s, "/api/users/" + std::to_string(s.user_id) + "/data");
+        if (d.response.status_code == 403) {
+            co_await send_async(chatId, "У вас нет разрешения на это действие.");
+            co_return;
         }
-        if (d.status_code == 403) {
-            safe_send(m->chat->id, "У вас нет разрешения на это действие.");
-            return;
-        }
-        if (d.status_code != 200) {
-            safe_send(m->chat->id, "Не удалось получить данные пользователя (HTTP " + std::to_string(d.status_code) + ")");
-            return;
+        if (d.response.status_code != 200) {
+            co_await send_async(
+                chatId, "Не удалось получить данные пользователя (HTTP " + std::to_string(d.response.status_code) + ")");
+            co_return;
         }
+        std::string text;
         try {
-            auto j = json::parse(d.text);
-            std::ostringstream msg;
-            msg << "Пользователь #" << j.value("id", 0) << "\n";
-            msg << "Username: " << j.value("username", "") << "\n";
-            msg << "Full name: " << j.value("full_name", "") << "\n";
-            msg << "Email: " << j.value("email", "") << "\n";
-            msg << "Blocked: " << (j.value("is_blocked", false) ? "yes" : "no") << "\n";
-            msg << "Courses: " << j.value("courses_count", 0) << "\n";
-            msg << "Attempts: " << j.value("attempts_count", 0);
-            safe_send(m->chat->id, msg.str());
+            if (!d.body) throw std::runtime_error("not json");
+            const json& j = *d.body;
+            std::pmr::string msg(scratch());
+            msg += "Пользователь #";
+            append_int(msg, j.value("id", 0));
+            msg += "\nUsername: ";
+            msg += str_field(j, "username");
+            msg += "\nFull name: ";
+            msg += str_field(j, "full_name");
+            msg += "\nEmail: ";
+            msg += str_field(j, "email");
+            msg += "\nBlocked: ";
+            msg += j.value("is_blocked", false) ? "yes" : "no";
+            msg += "\nCourses: ";
+            append_int(msg, j.value("courses_count", 0));
+            msg += "\nAttempts: ";
+            append_int(msg, j.value("attempts_count", 0));
+            text = msg;
         } catch (...) {
-            safe_send(m->chat->id, "Ошибка разбора ответа /api/users/{id}/data");
+            text = "Ошибка разбора ответа /api/users/{id}/data";
         }
+        co_await send_async(chatId, text);
     });
 
-    bot_.getEvents().onCommand("course_create", [this](TgBot::Message::Ptr m) {
+    on_command("course_create", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_by(payload, '|');
-        if (parts.empty() || trim(parts[0]).empty()) {
+        auto parts = split_by_view<2>(command_payload(m->text), '|');
+        if (parts.empty() || trim_view(parts[0]).empty()) {
             safe_send(m->chat->id, "Использование: /course_create <title> | <description>");
             return;
         }
-        std::string title = trim(parts[0]);
-        std::string desc = parts.size() > 1 ? trim(parts[1]) : "";
+        const std::string title(trim_view(parts[0]));
+        const std::string desc(trim_view(parts[1]));
 
-        auto r = main_.post_params("/api/courses",
-                                   s.access_token,
-                                   cpr::Parameters{{"title", title}, {"description", desc}});
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.post_params("/api/courses",
-                                  s.access_token,
-                                  cpr::Parameters{{"title", title}, {"description", desc}});
-        }
+        auto r = requests_.post_params(
+            m->chat->id, s, "/api/courses", cpr::Parameters{{"title", title}, {"description", desc}});
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -500,6 +786,7 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось создать курс (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        keyboards_.invalidate("courses");
         try {
             auto j = json::parse(r.text);
             safe_send(m->chat->id,
@@ -509,12 +796,11 @@ void TelegramModuleBot::setup_handlers() {
         }
     });
 
-    bot_.getEvents().onCommand("course_delete", [this](TgBot::Message::Ptr m) {
+    on_command("course_delete", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_ws(payload);
+        auto parts = split_ws_view<1>(command_payload(m->text));
         if (parts.size() < 1) {
             safe_send(m->chat->id, "Использование: /course_delete <course_id>");
             return;
@@ -524,11 +810,7 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "course_id должен быть числом.");
             return;
         }
-        auto r = main_.del("/api/courses/" + std::to_string(course_id), s.access_token);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.del("/api/courses/" + std::to_string(course_id), s.access_token);
-        }
+        auto r = requests_.del(m->chat->id, s, "/api/courses/" + std::to_string(course_id));
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -541,37 +823,34 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось удалить курс (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        keyboards_.invalidate("courses");
+        keyboards_.invalidate("tests:" + std::to_string(course_id));
         safe_send(m->chat->id, "✅ Курс удален (логически).");
     });
 
-    bot_.getEvents().onCommand("test_create", [this](TgBot::Message::Ptr m) {
+    on_command("test_create", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_by(payload, '|');
+        auto parts = split_by_view<3>(command_payload(m->text), '|');
         if (parts.size() < 3) {
             safe_send(m->chat->id, "Использование: /test_create <course_id> | <title> | <is_active 0|1>");
             return;
         }
         int course_id = 0;
-        if (!parse_int(trim(parts[0]), &course_id)) {
+        if (!parse_int(trim_view(parts[0]), &course_id)) {
             safe_send(m->chat->id, "course_id должен быть числом.");
             return;
         }
-        std::string title = trim(parts[1]);
+        const std::string title(trim_view(parts[1]));
         bool is_active = false;
-        if (!parse_bool_flag(trim(parts[2]), &is_active)) {
+        if (!parse_bool_flag(trim_view(parts[2]), &is_active)) {
             safe_send(m->chat->id, "is_active должен быть 0/1 или true/false.");
             return;
         }
 
         json body{{"title", title}, {"is_active", is_active}};
-        auto r = main_.post("/api/courses/" + std::to_string(course_id) + "/tests", s.access_token, &body);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.post("/api/courses/" + std::to_string(course_id) + "/tests", s.access_token, &body);
-        }
+        auto r = requests_.post(m->chat->id, s, "/api/courses/" + std::to_string(course_id) + "/tests", &body);
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -580,6 +859,7 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось создать тест (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        keyboards_.invalidate("tests:" + std::to_string(course_id));
         try {
             auto j = json::parse(r.text);
             safe_send(m->chat->id,
@@ -589,12 +869,11 @@ void TelegramModuleBot::setup_handlers() {
         }
     });
 
-    bot_.getEvents().onCommand("test_delete", [this](TgBot::Message::Ptr m) {
+    on_command("test_delete", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_ws(payload);
+        auto parts = split_ws_view<2>(command_payload(m->text));
         if (parts.size() < 2) {
             safe_send(m->chat->id, "Использование: /test_delete <course_id> <test_id>");
             return;
@@ -606,14 +885,8 @@ void TelegramModuleBot::setup_handlers() {
             return;
         }
 
-        auto r =
-            main_.del("/api/courses/" + std::to_string(course_id) + "/tests/" + std::to_string(test_id),
-                      s.access_token);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.del("/api/courses/" + std::to_string(course_id) + "/tests/" + std::to_string(test_id),
-                          s.access_token);
-        }
+        auto r = requests_.del(
+            m->chat->id, s, "/api/courses/" + std::to_string(course_id) + "/tests/" + std::to_string(test_id));
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -626,15 +899,15 @@ void TelegramModuleBot::setup_handlers() {
             safe_send(m->chat->id, "Не удалось удалить тест (HTTP " + std::to_string(r.status_code) + ")");
             return;
         }
+        keyboards_.invalidate("tests:" + std::to_string(course_id));
         safe_send(m->chat->id, "✅ Тест удален (логически).");
     });
 
-    bot_.getEvents().onCommand("question_create", [this](TgBot::Message::Ptr m) {
+    on_command("question_create", [this](TgBot::Message::Ptr m) {
         Session s = store_->load(m->chat->id);
         if (!ensure_auth(m->chat->id, s)) return;
 
-        auto payload = command_payload(m->text);
-        auto parts = split_by(payload, '|');
+        auto parts = split_by_view<5>(command_payload(m->text), '|');
         if (parts.size() < 5) {
             safe_send(m->chat->id,
                       "Использование: /question_create <test_id|0> | <title> | <text> | <opt1;opt2> | <correct_index>");
@@ -642,23 +915,24 @@ void TelegramModuleBot::setup_handlers() {
         }
 
         int test_id = 0;
-        if (!parse_int(trim(parts[0]), &test_id)) {
+        if (!parse_int(trim_view(parts[0]), &test_id)) {
             safe_send(m->chat->id, "test_id должен быть числом (0 если без привязки).");
             return;
         }
-        std::string title = trim(parts[1]);
-        std::string text = trim(parts[2]);
-        auto opt_parts = split_by(trim(parts[3]), ';');
+        const std::string title(trim_view(parts[1]));
+        const std::string text(trim_view(parts[2]));
         int correct_index = 0;
-        if (!parse_int(trim(parts[4]), &correct_index)) {
+        if (!parse_int(trim_view(parts[4]), &correct_index)) {
             safe_send(m->chat->id, "correct_index должен быть числом.");
             return;
         }
 
         std::vector<std::string> options;
-        for (auto& o : opt_parts) {
-            auto t = trim(o);
-            if (!t.empty()) options.push_back(t);
+        FieldSplitter opt_parts(trim_view(parts[3]), ';');
+        std::string_view o;
+        while (opt_parts.next(o)) {
+            auto t = trim_view(o);
+            if (!t.empty()) options.emplace_back(t);
         }
         if (options.empty()) {
             safe_send(m->chat->id, "Нужно указать хотя бы один вариант ответа.");
@@ -676,11 +950,7 @@ void TelegramModuleBot::setup_handlers() {
             body["test_id"] = nullptr;
         }
 
-        auto r = main_.post("/api/questions", s.access_token, &body);
-        if (r.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(m->chat->id, s);
-            r = main_.post("/api/questions", s.access_token, &body);
-        }
+        auto r = requests_.post(m->chat->id, s, "/api/questions", &body);
         if (r.status_code == 403) {
             safe_send(m->chat->id, "У вас нет разрешения на это действие.");
             return;
@@ -697,141 +967,286 @@ void TelegramModuleBot::setup_handlers() {
     });
 
     bot_.getEvents().onCallbackQuery([this](TgBot::CallbackQuery::Ptr q) {
-        const auto chatId = q->message->chat->id;
-        Session s = store_->load(chatId);
-        if (!ensure_auth(chatId, s)) {
-            bot_.getApi().answerCallbackQuery(q->id);
+        UpdateCapture::instance().callback(q);
+        static const HandlerMetrics rejected = handler_metrics("cb_invalid");
+        static Counter& duplicates =
+            MetricsRegistry::instance().counter("tg_callback_duplicates_total", "Callback queries dropped as repeats");
+        CallbackData d;
+        const CallbackRoute* route = nullptr;
+        if (decode_callback(q->data, &d)) route = &callback_routes_[static_cast<unsigned char>(d.action)];
+        if (!route || !route->bound()) {
+            rejected.calls->inc();
+            acknowledge(q->id, nullptr);
             return;
         }
+        route->calls->inc();
 
-        const std::string data = q->data;
-        if (starts_with(data, "course:")) {
-            s.current_course_id = std::stoi(data.substr(std::string("course:").size()));
-            store_->save(chatId, s);
-            show_course_tests(chatId, s);
-        } else if (starts_with(data, "test:")) {
-            s.current_test_id = std::stoi(data.substr(std::string("test:").size()));
-            store_->save(chatId, s);
-            start_attempt(chatId, s);
-        } else if (starts_with(data, "ans:")) {
-            handle_answer(chatId, s, data);
-        } else if (starts_with(data, "finish:")) {
-            finish_attempt(chatId, s);
-        } else if (data == "back:courses") {
-            show_courses(chatId, s);
+        const auto chatId = q->message->chat->id;
+        const std::int32_t messageId = q->message->messageId;
+        // A redelivered tap must not use up the chat's budget a second time.
+        if (!seen_callbacks_.first_seen("q:" + q->id)) {
+            duplicates.inc();
+            return;
         }
+        // Refused taps get their notice on the acknowledgement instead of a message.
+        const auto verdict = limiter_.admit(chatId, route->rate_class);
+        // Acknowledge at dispatch so the client's spinner stops at once; the
+        // handler's result shows up as an edit of the tapped message.
+        if (verdict != RateLimiter::Verdict::ADMIT) {
+            acknowledge(q->id, "⏳ Слишком часто. Подожди немного.");
+            return;
+        }
+        acknowledge(q->id, nullptr);
 
-        bot_.getApi().answerCallbackQuery(q->id);
+        if (shed(chatId, &main_.breaker())) {
+            // Let the same tap through once the backend is back.
+            seen_callbacks_.forget("q:" + q->id);
+            return;
+        }
+        dispatcher_.submit_async(chatId, [this, route, chatId, messageId, d]() -> Task<void> {
+            if (limiter_.shared() && !co_await io_.run([&] { return limiter_.admit_shared(chatId, route->rate_class); })) {
+                co_return;
+            }
+            ScopedTimer timer(*route->latency);
+            TraceScope trace(route->name, chatId);
+            FlightScope flight(route->name, chatId);
+            UpdateArena arena;
+            Session s;
+            if (!co_await load_authed(chatId, s)) co_return;
+            if (route->async_fn) {
+                co_await (this->*route->async_fn)(chatId, messageId, s, d);
+            } else {
+                (this->*route->fn)(chatId, messageId, s, d);
+            }
+        });
     });
 
     bot_.getEvents().onAnyMessage([this](TgBot::Message::Ptr m) {
+        // Every message passes here, commands included, so this is where they are captured.
+        UpdateCapture::instance().message(m);
         if (!m || m->text.empty()) return;
         if (!m->text.empty() && m->text[0] == '/') {
-            static const std::set<std::string> known = {"/start",
-                                                        "/help",
-                                                        "/login",
-                                                        "/logout",
-                                                        "/courses",
-                                                        "/users",
-                                                        "/ban",
-                                                        "/unban",
-                                                        "/set_full_name",
-                                                        "/course_create",
-                                                        "/course_delete",
-                                                        "/test_create",
-                                                        "/test_delete",
-                                                        "/question_create",
-                                                        "/me"};
-            auto cmd = m->text;
-            auto pos = cmd.find(' ');
-            if (pos != std::string::npos) cmd = cmd.substr(0, pos);
+            static const std::set<std::string, std::less<>> known = {"/start",
+                                                                     "/help",
+                                                                     "/login",
+                                                                     "/logout",
+                                                                     "/courses",
+                                                                     "/users",
+                                                                     "/ban",
+                                                                     "/unban",
+                                                                     "/set_full_name",
+                                                                     "/course_create",
+                                                                     "/course_delete",
+                                                                     "/test_create",
+                                                                     "/test_delete",
+                                                                     "/question_create",
+                                                                     "/me"};
+            std::string_view cmd = m->text;
+            auto pos = find_byte(cmd, ' ');
+            if (pos != std::string_view::npos) cmd = cmd.substr(0, pos);
             if (known.count(cmd) == 0) {
+                static const HandlerMetrics unknown = handler_metrics("unknown");
+                unknown.calls->inc();
+                // No notice when refused: the reply is all an unknown command costs.
+                if (limiter_.admit(m->chat->id, RateLimiter::Class::UNKNOWN) != RateLimiter::Verdict::ADMIT) return;
                 safe_send(m->chat->id, "Нет такой команды. /start");
             }
         }
     });
 }
 
-TgBot::InlineKeyboardMarkup::Ptr TelegramModuleBot::make_kb(
-    const std::vector<std::pair<std::string, std::string>>& buttons) {
-    auto kb = TgBot::InlineKeyboardMarkup::Ptr(new TgBot::InlineKeyboardMarkup);
-    for (const auto& [text, data] : buttons) {
-        std::vector<TgBot::InlineKeyboardButton::Ptr> row;
-        auto b = TgBot::InlineKeyboardButton::Ptr(new TgBot::InlineKeyboardButton);
-        b->text = text;
-        b->callbackData = data;
-        row.push_back(b);
-        kb->inlineKeyboard.push_back(row);
+TelegramModuleBot::UsersPage TelegramModuleBot::users_page(std::int64_t chatId, Session& s, int offset) {
+    static const int page_size = std::max(1, std::stoi(getenv_or("TG_USERS_PAGE_SIZE", "20")));
+    static const std::chrono::seconds ttl(std::stoi(getenv_or("TG_USERS_PAGE_TTL_SEC", "30")));
+
+    const auto now = std::chrono::steady_clock::now();
+    const std::string key = std::to_string(chatId) + ":" + std::to_string(offset);
+    {
+        std::lock_guard<std::mutex> lk(users_pages_mtx_);
+        auto it = users_pages_.find(key);
+        if (it != users_pages_.end() && now - it->second.fetched < ttl) return it->second;
+    }
+
+    // Ask for one extra row to learn whether a next page exists. A backend that
+    // ignores limit/offset returns the whole list; in that case the page is cut
+    // out locally from the element positions instead.
+    std::pmr::string paged(scratch());
+    std::pmr::string sliced(scratch());
+    std::pmr::string line(scratch());
+    std::size_t seen = 0;
+    long long first_id = -1;
+    bool bad_element = false;
+    const auto want = static_cast<std::size_t>(page_size);
+    const auto from = static_cast<std::size_t>(offset);
+    JsonArrayStream users([&](std::string_view el) {
+        const std::size_t i = seen++;
+        const bool in_paged = i < want;
+        const bool in_sliced = i >= from && i < from + want;
+        if (!in_paged && !in_sliced) return true;
+        try {
+            auto u = json::parse(el);
+            const auto username = str_field(u, "username");
+            const auto fn = str_field(u, "full_name");
+            if (i == 0) first_id = u.value("id", 0LL);
+            line.assign("#");
+            append_int(line, u.value("id", 0));
+            line += ' ';
+            line += u.contains("username") ? username : std::string_view("user");
+            if (!fn.empty()) {
+                line += " (";
+                line += fn;
+                line += ')';
+            }
+            if (u.value("is_blocked", false)) line += " [blocked]";
+            line += '\n';
+            if (in_paged) paged += line;
+            if (in_sliced) sliced += line;
+            return true;
+        } catch (...) {
+            bad_element = true;
+            return false;
+        }
+    });
+
+    const std::string path =
+        "/api/users?limit=" + std::to_string(page_size + 1) + "&offset=" + std::to_string(offset);
+    auto r = get_array(chatId, s, path, users);
+
+    UsersPage page;
+    page.http = r.status_code;
+    page.fetched = now;
+    page.first_id = first_id;
+    if (r.status_code != 200) return page;
+    if (bad_element || (users.is_array() && !users.complete())) {
+        page.text = "Ошибка разбора ответа /api/users";
+        return page;
+    }
+
+    // More rows than asked for means limit was ignored. Up to want + 1 rows
+    // past the first page is only paged if they are not the rows of the page
+    // before it again: a backend ignoring offset returns the same head each time.
+    bool server_paged = seen <= want + 1;
+    if (server_paged && offset > 0 && seen > 0) {
+        std::lock_guard<std::mutex> lk(users_pages_mtx_);
+        auto prev = users_pages_.find(std::to_string(chatId) + ":" + std::to_string(std::max(0, offset - page_size)));
+        if (prev != users_pages_.end() && prev->second.first_id == first_id) server_paged = false;
+    }
+    const std::pmr::string& rows = server_paged ? paged : sliced;
+    const bool has_next = server_paged ? seen > want : seen > from + want;
+    if (rows.empty()) {
+        page.text = offset == 0 ? "Список пользователей пуст." : "Больше пользователей нет.";
+    } else {
+        const std::size_t shown = std::min(want, (server_paged ? seen : seen - std::min(seen, from)));
+        page.text = "Пользователи " + std::to_string(offset + 1) + "–" + std::to_string(from + shown) + ":\n";
+        page.text += rows;
+    }
+    if (offset > 0) page.prev_offset = std::max(0, offset - page_size);
+    if (has_next) page.next_offset = offset + page_size;
+
+    std::lock_guard<std::mutex> lk(users_pages_mtx_);
+    if (users_pages_.size() >= 256) {
+        for (auto it = users_pages_.begin(); it != users_pages_.end();) {
+            it = (now - it->second.fetched >= ttl) ? users_pages_.erase(it) : std::next(it);
+        }
     }
-    return kb;
+    users_pages_[key] = page;
+    return page;
 }
 
-void TelegramModuleBot::show_courses(std::int64_t chatId, Session& s) {
-    auto r = main_.get("/api/courses", s.access_token);
-    if (r.status_code == 401 && refresh_if_needed(s)) {
-        store_->save(chatId, s);
-        r = main_.get("/api/courses", s.access_token);
+// messageId == 0 sends a fresh message (the /users command); otherwise the page
+// replaces the text of the message whose ◀/▶ button was tapped.
+void TelegramModuleBot::show_users_page(std::int64_t chatId, std::int32_t messageId, Session& s, int offset) {
+    const UsersPage page = users_page(chatId, s, offset);
+    if (page.http == 403) {
+        safe_send(chatId, "У вас нет разрешения на это действие.");
+        return;
     }
-    if (r.status_code != 200) {
-        safe_send(chatId, "Не удалось получить курсы (HTTP " + std::to_string(r.status_code) + ")");
+    if (page.http == 404) {
+        safe_send(chatId, "Пользователи не найдены.");
         return;
     }
-    try {
-        auto j = json::parse(r.text);
-        std::vector<std::pair<std::string, std::string>> btns;
-        for (auto& c : j) {
+    if (page.http != 200) {
+        safe_send(chatId, "Не удалось получить пользователей (HTTP " + std::to_string(page.http) + ")");
+        return;
+    }
+
+    std::vector<std::pair<std::string, std::string>> nav;
+    if (page.prev_offset >= 0) nav.push_back({"◀", encode_callback(CallbackAction::USERS_PAGE, page.prev_offset)});
+    if (page.next_offset >= 0) nav.push_back({"▶", encode_callback(CallbackAction::USERS_PAGE, page.next_offset)});
+    auto kb = nav.empty() ? nullptr : keyboards_.get("users", KeyboardCache::Layout::ROW, nav);
+
+    if (messageId == 0) {
+        safe_send(chatId, page.text, kb);
+    } else {
+        safe_edit(chatId, messageId, page.text, kb);
+    }
+}
+
+Task<void> TelegramModuleBot::show_courses(std::int64_t chatId, Session& s) {
+    std::vector<std::pair<std::string, std::string>> btns;
+    JsonArrayStream courses([&](std::string_view el) {
+        try {
+            auto c = json::parse(el);
             btns.push_back({c.value("title", "курс") + " (#" + std::to_string(c.value("id", 0)) + ")",
-                            "course:" + std::to_string(c.value("id", 0))});
-        }
-        if (btns.empty()) {
-            safe_send(chatId, "Курсов пока нет.");
-            return;
+                            encode_callback(CallbackAction::COURSE, c.value("id", 0))});
+            return true;
+        } catch (...) {
+            return false;
         }
-        safe_send(chatId, "Выбери курс:", make_kb(btns));
-    } catch (...) {
-        safe_send(chatId, "Ошибка разбора ответа /api/courses");
+    });
+    auto r = co_await io_.run([&] { return get_array(chatId, s, "/api/courses", courses); });
+    if (r.status_code != 200) {
+        co_await send_async(chatId, "Не удалось получить курсы (HTTP " + std::to_string(r.status_code) + ")");
+        co_return;
+    }
+    if (courses.is_array() && !courses.complete()) {
+        co_await send_async(chatId, "Ошибка разбора ответа /api/courses");
+        co_return;
+    }
+    if (btns.empty()) {
+        co_await send_async(chatId, "Курсов пока нет.");
+        co_return;
     }
+    co_await send_async(chatId, "Выбери курс:", keyboards_.get("courses", KeyboardCache::Layout::COLUMN, btns));
 }
 
-void TelegramModuleBot::show_course_tests(std::int64_t chatId, Session& s) {
+Task<void> TelegramModuleBot::show_course_tests(std::int64_t chatId, Session& s) {
     if (s.current_course_id < 0) {
-        safe_send(chatId, "Сначала выбери курс: /courses");
-        return;
-    }
-    auto r = main_.get("/api/courses/" + std::to_string(s.current_course_id) + "/tests", s.access_token);
-    if (r.status_code == 401 && refresh_if_needed(s)) {
-        store_->save(chatId, s);
-        r = main_.get("/api/courses/" + std::to_string(s.current_course_id) + "/tests", s.access_token);
+        co_await send_async(chatId, "Сначала выбери курс: /courses");
+        co_return;
     }
-    if (r.status_code != 200) {
-        safe_send(chatId, "Не удалось получить тесты (HTTP " + std::to_string(r.status_code) + ")");
-        return;
+    auto r = co_await main_get_async(chatId, s, "/api/courses/" + std::to_string(s.current_course_id) + "/tests");
+    if (r.response.status_code != 200) {
+        co_await send_async(chatId, "Не удалось получить тесты (HTTP " + std::to_string(r.response.status_code) + ")");
+        co_return;
     }
+    TgBot::InlineKeyboardMarkup::Ptr kb;
     try {
-        auto j = json::parse(r.text);
+        if (!r.body) throw std::runtime_error("not json");
+        const json& j = *r.body;
         std::vector<std::pair<std::string, std::string>> btns;
         for (auto& t : j) {
             const bool active = t.value("is_active", false);
             std::string title = t.value("title", "test") + (active ? " ✅" : " ⛔");
             if (active) {
-                btns.push_back({title, "test:" + std::to_string(t.value("id", 0))});
+                btns.push_back({title, encode_callback(CallbackAction::TEST, t.value("id", 0))});
             }
         }
-        btns.push_back({"⬅️ Назад", "back:courses"});
-        safe_send(chatId, "Тесты курса (только активные):", make_kb(btns));
+        btns.push_back({"⬅️ Назад", encode_callback(CallbackAction::BACK_COURSES)});
+        kb = keyboards_.get("tests:" + std::to_string(s.current_course_id), KeyboardCache::Layout::COLUMN, btns);
     } catch (...) {
-        safe_send(chatId, "Ошибка разбора ответа tests");
     }
+    if (!kb) {
+        co_await send_async(chatId, "Ошибка разбора ответа tests");
+        co_return;
+    }
+    co_await send_async(chatId, "Тесты курса (только активные):", kb);
 }
 
 void TelegramModuleBot::start_attempt(std::int64_t chatId, Session& s) {
     if (s.current_test_id < 0) return;
 
-    auto r = main_.post("/api/attempts/tests/" + std::to_string(s.current_test_id), s.access_token);
-    if (r.status_code == 401 && refresh_if_needed(s)) {
-        store_->save(chatId, s);
-        r = main_.post("/api/attempts/tests/" + std::to_string(s.current_test_id), s.access_token);
-    }
+    auto r = requests_.post(chatId, s, "/api/attempts/tests/" + std::to_string(s.current_test_id));
     if (r.status_code != 201 && r.status_code != 200) {
         safe_send(chatId, "Не удалось начать попытку (HTTP " + std::to_string(r.status_code) + ")");
         return;
@@ -840,68 +1255,155 @@ void TelegramModuleBot::start_attempt(std::int64_t chatId, Session& s) {
         auto j = json::parse(r.text);
         s.current_attempt_id = j.value("id", -1);
         s.current_answer_index = 0;
+        // The placeholder becomes the question message that every answer edits.
+        s.question_message_id = safe_send(chatId, "📝 Попытка начата. Загружаю вопрос...");
         store_->save(chatId, s);
-        safe_send(chatId, "📝 Попытка начата. Загружаю вопрос...");
         show_current_question(chatId, s);
     } catch (...) {
         safe_send(chatId, "Ошибка разбора ответа attempts");
     }
 }
 
+int TelegramModuleBot::attempt_plan(std::int64_t chatId, Session& s, AttemptPlan* out) {
+    {
+        std::lock_guard<std::mutex> lk(plans_mtx_);
+        auto it = plans_.find(chatId);
+        if (it != plans_.end() && it->second->second.attempt_id == s.current_attempt_id) {
+            plans_lru_.splice(plans_lru_.begin(), plans_lru_, it->second);
+            *out = it->second->second;
+            return 200;
+        }
+    }
+
+    AttemptPlan plan{s.current_attempt_id, {}};
+    bool bad_element = false;
+    JsonArrayStream answers([&](std::string_view el) {
+        try {
+            auto a = json::parse(el);
+            plan.answers.emplace_back(a.value("id", -1), a.value("question_id", -1));
+            return true;
+        } catch (...) {
+            bad_element = true;
+            return false;
+        }
+    });
+    auto r = get_array(chatId, s, "/api/answers/attempts/" + std::to_string(s.current_attempt_id), answers);
+    if (r.status_code != 200) return static_cast<int>(r.status_code);
+    if (bad_element || (answers.is_array() && !answers.complete())) return -1;
+
+    *out = plan;
+    std::lock_guard<std::mutex> lk(plans_mtx_);
+    auto it = plans_.find(chatId);
+    if (it != plans_.end()) {
+        it->second->second = std::move(plan);
+        plans_lru_.splice(plans_lru_.begin(), plans_lru_, it->second);
+        return 200;
+    }
+    plans_lru_.emplace_front(chatId, std::move(plan));
+    plans_[chatId] = plans_lru_.begin();
+    if (plans_lru_.size() > kMaxPlans) {
+        plans_.erase(plans_lru_.back().first);
+        plans_lru_.pop_back();
+    }
+    return 200;
+}
+
+void TelegramModuleBot::forget_plan(std::int64_t chatId) {
+    std::lock_guard<std::mutex> lk(plans_mtx_);
+    auto it = plans_.find(chatId);
+    if (it == plans_.end()) return;
+    plans_lru_.erase(it->second);
+    plans_.erase(it);
+}
+
 void TelegramModuleBot::show_current_question(std::int64_t chatId, Session& s) {
     if (s.current_attempt_id < 0) return;
 
-    auto rAns = main_.get("/api/answers/attempts/" + std::to_string(s.current_attempt_id), s.access_token);
-    if (rAns.status_code == 401 && refresh_if_needed(s)) {
-        store_->save(chatId, s);
-        rAns = main_.get("/api/answers/attempts/" + std::to_string(s.current_attempt_id), s.access_token);
+    int answer_id = -1;
+    int question_id = -1;
+    std::size_t total = 0;
+    if (batch_answers_) {
+        AttemptPlan plan;
+        const int http = attempt_plan(chatId, s, &plan);
+        if (http < 0) {
+            safe_send(chatId, "Ошибка разбора данных вопроса");
+            return;
+        }
+        if (http != 200) {
+            safe_send(chatId, "Не удалось получить ответы попытки (HTTP " + std::to_string(http) + ")");
+            return;
+        }
+        total = plan.answers.size();
+        if (s.current_answer_index >= 0 && static_cast<std::size_t>(s.current_answer_index) < total) {
+            std::tie(answer_id, question_id) = plan.answers[static_cast<std::size_t>(s.current_answer_index)];
+        }
+    } else {
+        // Only the answer for the current position is parsed; the rest of the
+        // list is just counted as it streams past.
+        bool bad_element = false;
+        std::size_t seen = 0;
+        JsonArrayStream answers([&](std::string_view el) {
+            if (seen++ != static_cast<std::size_t>(s.current_answer_index)) return true;
+            try {
+                auto a = json::parse(el);
+                answer_id = a.value("id", -1);
+                question_id = a.value("question_id", -1);
+                return true;
+            } catch (...) {
+                bad_element = true;
+                return false;
+            }
+        });
+        auto rAns = get_array(chatId, s, "/api/answers/attempts/" + std::to_string(s.current_attempt_id), answers);
+        if (rAns.status_code != 200) {
+            safe_send(chatId, "Не удалось получить ответы попытки (HTTP " + std::to_string(rAns.status_code) + ")");
+            return;
+        }
+        if (bad_element || (answers.is_array() && !answers.complete())) {
+            safe_send(chatId, "Ошибка разбора данных вопроса");
+            return;
+        }
+        total = answers.count();
     }
-    if (rAns.status_code != 200) {
-        safe_send(chatId, "Не удалось получить ответы попытки (HTTP " + std::to_string(rAns.status_code) + ")");
+
+    if (total == 0) {
+        safe_send(chatId, "В этой попытке нет вопросов.");
         return;
     }
 
     try {
-        auto answers = json::parse(rAns.text);
-        if (!answers.is_array() || answers.empty()) {
-            safe_send(chatId, "В этой попытке нет вопросов.");
-            return;
-        }
-
-        if (s.current_answer_index >= static_cast<int>(answers.size())) {
-            auto kb = make_kb({{"🏁 Завершить попытку", "finish:" + std::to_string(s.current_attempt_id)}});
-            safe_send(chatId, "Вопросы закончились.", kb);
+        if (s.current_answer_index >= static_cast<int>(total)) {
+            auto kb = keyboards_.get("finish",
+                                     KeyboardCache::Layout::COLUMN,
+                                     {{"🏁 Завершить попытку", encode_callback(CallbackAction::FINISH, s.current_attempt_id)}});
+            render_question(chatId, s, "Вопросы закончились.", kb);
             return;
         }
 
-        auto a = answers.at(s.current_answer_index);
-        int answer_id = a.value("id", -1);
-        int question_id = a.value("question_id", -1);
         if (answer_id < 0 || question_id < 0) {
             safe_send(chatId, "Некорректные данные вопроса.");
             return;
         }
 
-        auto rQ = main_.get("/api/questions/" + std::to_string(question_id), s.access_token);
-        if (rQ.status_code == 401 && refresh_if_needed(s)) {
-            store_->save(chatId, s);
-            rQ = main_.get("/api/questions/" + std::to_string(question_id), s.access_token);
-        }
-        if (rQ.status_code != 200) {
-            safe_send(chatId, "Не удалось получить вопрос (HTTP " + std::to_string(rQ.status_code) + ")");
+        auto rQ = requests_.get_json(chatId, s, "/api/questions/" + std::to_string(question_id));
+        if (rQ.response.status_code != 200) {
+            safe_send(chatId, "Не удалось получить вопрос (HTTP " + std::to_string(rQ.response.status_code) + ")");
             return;
         }
+        if (!rQ.body) throw std::runtime_error("not json");
 
-        auto q = json::parse(rQ.text);
-        std::string title = q.value("title", "Вопрос");
-        std::string text = q.value("text", "");
-        auto opts = q.value("options", json::array());
+        const json& q = *rQ.body;
+        const std::string_view title = q.contains("title") ? str_field(q, "title") : std::string_view("Вопрос");
+        const std::string_view text = str_field(q, "text");
+        static const json kNoOptions = json::array();
+        auto opts_it = q.find("options");
+        const json& opts = opts_it != q.end() && opts_it->is_array() ? *opts_it : kNoOptions;
 
         std::vector<std::pair<std::string, std::string>> btns;
         int idx = 0;
         for (auto& opt : opts) {
             btns.push_back({opt.get<std::string>(),
-                            "ans:" + std::to_string(answer_id) + ":" + std::to_string(idx)});
+                            encode_callback(CallbackAction::ANSWER, answer_id, idx)});
             idx++;
         }
         if (btns.empty()) {
@@ -909,28 +1411,80 @@ void TelegramModuleBot::show_current_question(std::int64_t chatId, Session& s) {
             return;
         }
 
-        std::ostringstream msg;
-        msg << "(" << (s.current_answer_index + 1) << "/" << answers.size() << ") " << title << "\n\n"
-            << text;
-        safe_send(chatId, msg.str(), make_kb(btns));
+        std::pmr::string msg(scratch());
+        msg += '(';
+        append_int(msg, s.current_answer_index + 1);
+        msg += '/';
+        append_int(msg, static_cast<long long>(total));
+        msg += ") ";
+        msg += title;
+        msg += "\n\n";
+        msg += text;
+        render_question(chatId, s, std::string(msg), make_kb(btns));
     } catch (...) {
         safe_send(chatId, "Ошибка разбора данных вопроса");
     }
 }
 
-void TelegramModuleBot::handle_answer(std::int64_t chatId, Session& s, const std::string& data) {
-    auto parts = split_by(data, ':');
-    if (parts.size() != 3) return;
-
-    int answer_id = std::stoi(parts[1]);
-    int value = std::stoi(parts[2]);
+void TelegramModuleBot::render_question(std::int64_t chatId,
+                                        Session& s,
+                                        const std::string& text,
+                                        TgBot::InlineKeyboardMarkup::Ptr kb) {
+    if (s.question_message_id != 0 && safe_edit(chatId, s.question_message_id, text, kb)) return;
+    const std::int32_t id = safe_send(chatId, text, kb);
+    if (id != 0 && id != s.question_message_id) {
+        s.question_message_id = id;
+        store_->save(chatId, s);
+    }
+}
 
-    auto r = main_.patch("/api/answers/" + std::to_string(answer_id), s.access_token, json{{"value", value}});
-    if (r.status_code == 401 && refresh_if_needed(s)) {
+void TelegramModuleBot::handle_answer(std::int64_t chatId, Session& s, int answer_id, int value) {
+    if (batch_answers_) {
+        static Counter& stale = MetricsRegistry::instance().counter(
+            "tg_answers_stale_total", "Batched answer taps that were not for the current question");
+        // Nothing checks a logged answer until it is flushed, so only the
+        // current question's answer is taken; anything else gets that question
+        // again. A plan lost to a restart or eviction is read back first.
+        AttemptPlan plan;
+        const int http = attempt_plan(chatId, s, &plan);
+        if (http != 200) {
+            seen_callbacks_.forget(answer_key(chatId, answer_id));
+            safe_send(chatId,
+                      http < 0 ? std::string("Ошибка разбора данных вопроса")
+                               : "Не удалось получить ответы попытки (HTTP " + std::to_string(http) + ")");
+            return;
+        }
+        const auto idx = static_cast<std::size_t>(s.current_answer_index);
+        const bool current =
+            s.current_answer_index >= 0 && idx < plan.answers.size() && plan.answers[idx].first == answer_id;
+        if (!current) {
+            stale.inc();
+            seen_callbacks_.forget(answer_key(chatId, answer_id));
+            show_current_question(chatId, s);
+            return;
+        }
+        const long long queued = answer_log_.append(chatId, s.current_attempt_id, answer_id, value);
+        if (queued == 0) {
+            seen_callbacks_.forget(answer_key(chatId, answer_id));
+            safe_send(chatId, "Не удалось сохранить ответ. Попробуй ещё раз.");
+            return;
+        }
+        s.current_answer_index += 1;
         store_->save(chatId, s);
-        r = main_.patch("/api/answers/" + std::to_string(answer_id), s.access_token, json{{"value", value}});
+        show_current_question(chatId, s);
+        if (queued >= answer_batch_ && !main_.breaker().rejecting()) {
+            // Queued behind this update in the chat's chain, so the next question goes out first.
+            dispatcher_.submit(chatId, [this, chatId, attempt = s.current_attempt_id]() {
+                Session fresh = store_->load(chatId);
+                if (fresh.status == SessionStatus::AUTH) (void)flush_answers(chatId, fresh, attempt);
+            });
+        }
+        return;
     }
+
+    auto r = requests_.patch(chatId, s, "/api/answers/" + std::to_string(answer_id), json{{"value", value}});
     if (r.status_code != 200) {
+        seen_callbacks_.forget(answer_key(chatId, answer_id));
         safe_send(chatId, "Не удалось сохранить ответ (HTTP " + std::to_string(r.status_code) + ")");
         return;
     }
@@ -940,100 +1494,311 @@ void TelegramModuleBot::handle_answer(std::int64_t chatId, Session& s, const std
     show_current_question(chatId, s);
 }
 
+bool TelegramModuleBot::flush_answers(std::int64_t chatId, Session& s, int attemptId) {
+    static Counter& flushed =
+        MetricsRegistry::instance().counter("tg_answers_flushed_total", "Logged answers delivered to the backend");
+    static Counter& refused =
+        MetricsRegistry::instance().counter("tg_answers_refused_total", "Logged answers the backend rejected for good");
+    static Histogram& latency =
+        MetricsRegistry::instance().histogram("tg_answer_flush_seconds", "Time to send an attempt's logged answers");
+
+    auto pending = answer_log_.pending(chatId, attemptId);
+    if (!pending) return false;
+    ScopedTimer timer(latency);
+    std::size_t done = 0;
+    bool complete = true;
+    for (const auto& p : *pending) {
+        auto r = requests_.patch(chatId, s, "/api/answers/" + std::to_string(p.answer_id), json{{"value", p.value}});
+        if (r.status_code == 0 || r.status_code == 401 || r.status_code == 429 || r.status_code >= 500) {
+            complete = false;
+            break;
+        }
+        if (r.status_code == 200) {
+            flushed.inc();
+        } else {
+            // Sending it again would get the same answer.
+            refused.inc();
+            safe_send(chatId, "Ответ не принят сервером (HTTP " + std::to_string(r.status_code) + ")");
+        }
+        ++done;
+    }
+    return answer_log_.drop(chatId, attemptId, done, pending->size()) && complete;
+}
+
 void TelegramModuleBot::finish_attempt(std::int64_t chatId, Session& s) {
     if (s.current_attempt_id < 0) return;
 
-    auto r = main_.post("/api/attempts/" + std::to_string(s.current_attempt_id) + "/finish", s.access_token);
-    if (r.status_code == 401 && refresh_if_needed(s)) {
-        store_->save(chatId, s);
-        r = main_.post("/api/attempts/" + std::to_string(s.current_attempt_id) + "/finish", s.access_token);
+    // Logged answers go first: the backend scores whatever it has when the attempt is finished.
+    if (batch_answers_ && !flush_answers(chatId, s, s.current_attempt_id)) {
+        safe_send(chatId, "⏳ Не удалось отправить ответы. Попробуй завершить попытку ещё раз.");
+        return;
     }
+
+    auto r = requests_.post(chatId, s, "/api/attempts/" + std::to_string(s.current_attempt_id) + "/finish");
     if (r.status_code != 200) {
         safe_send(chatId, "Не удалось завершить попытку (HTTP " + std::to_string(r.status_code) + ")");
         return;
     }
 
+    // The result replaces the question message, which also drops its keyboard.
+    std::string result = "Попытка завершена.";
     try {
         auto j = json::parse(r.text);
         auto score = j.value("score", 0.0);
-        safe_send(chatId, "🏁 Попытка завершена. Score: " + std::to_string(score));
+        result = "🏁 Попытка завершена. Score: " + std::to_string(score);
     } catch (...) {
-        safe_send(chatId, "Попытка завершена.");
     }
+    render_question(chatId, s, result, nullptr);
 
+    if (batch_answers_) forget_plan(chatId);
     s.current_attempt_id = -1;
     s.current_answer_index = 0;
+    s.question_message_id = 0;
     store_->save(chatId, s);
 }
 
+void TelegramModuleBot::sweep_page(const std::vector<std::int64_t>& chats,
+                                   const std::function<void(std::int64_t)>& work) {
+    std::latch done(static_cast<std::ptrdiff_t>(chats.size()));
+    for (auto chatId : chats) {
+        dispatcher_.submit(chatId, [&work, &done, chatId]() {
+            try {
+                work(chatId);
+            } catch (...) {
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+}
+
 void TelegramModuleBot::start_auth_poll_thread() {
-    std::thread([this]() {
-        while (true) {
-            std::this_thread::sleep_for(std::chrono::seconds(3));
-            for (auto chatId : store_->anon_chats()) {
-                Session s = store_->load(chatId);
-                if (s.status != SessionStatus::ANON || s.token_in.empty()) {
-                    store_->mark_anon(chatId);
-                    continue;
-                }
-                auto cr = auth_.check(s.token_in);
-                if (cr.http == 200 && cr.status == "доступ предоставлен" && !cr.access.empty() && !cr.refresh.empty()) {
-                    s.status = SessionStatus::AUTH;
-                    s.access_token = cr.access;
-                    s.refresh_token = cr.refresh;
-                    s.token_in.clear();
-                    store_->save(chatId, s);
-                    store_->mark_auth(chatId);
-                    safe_send(chatId, "✅ Авторизация завершена. /courses");
-                } else if (cr.http == 401 || cr.http == 404) {
-                    store_->clear(chatId);
-                    safe_send(chatId, "⏳ Авторизация истекла. Запусти снова: /login github|yandex|code");
-                }
+    background_.emplace_back([this, page = sweep_page_size(), stop = stop_.get_token()]() {
+        auto& reg = MetricsRegistry::instance();
+        Gauge& pending = reg.gauge("tg_pending_logins", "Chats with a login in progress");
+        Gauge& sweep = reg.gauge("tg_auth_sweep_seconds", "Duration of the last pending-login sweep");
+        Counter& skipped = sweeps_skipped("auth");
+        const std::chrono::milliseconds every = std::chrono::seconds(3);
+        auto wait = jittered(every, 0.0, 1.0);
+        while (sleep_unless_stopped(stop, wait)) {
+            wait = jittered(every, 0.9, 1.1);
+            if (auth_.breaker().rejecting()) {
+                skipped.inc();
+                continue;
             }
+            const auto started = std::chrono::steady_clock::now();
+            std::unordered_set<std::int64_t> seen;
+            std::string cursor = "0";
+            std::atomic<bool> halted{false};
+            do {
+                auto chats = store_->scan_chats(SessionStore::ChatSet::ANON, &cursor, page);
+                std::erase_if(chats, [&](std::int64_t chatId) { return !seen.insert(chatId).second || !cluster_.owns(chatId); });
+                sweep_page(chats, [&](std::int64_t chatId) {
+                    if (halted) return;
+                    if (stop.stop_requested()) {
+                        halted = true;
+                        return;
+                    }
+                    if (auth_.breaker().rejecting()) {
+                        if (!halted.exchange(true)) skipped.inc();
+                        return;
+                    }
+                    Session s = store_->load(chatId);
+                    if (s.status != SessionStatus::ANON || s.token_in.empty()) {
+                        store_->mark_anon(chatId);
+                        return;
+                    }
+                    auto cr = auth_.check(s.token_in);
+                    if (cr.http == 200 && cr.status == "доступ предоставлен" && !cr.access.empty() && !cr.refresh.empty()) {
+                        s.status = SessionStatus::AUTH;
+                        s.access_token = cr.access;
+                        s.refresh_token = cr.refresh;
+                        s.token_in.clear();
+                        requests_.identify(chatId, s);
+                        store_->save(chatId, s);
+                        store_->mark_auth(chatId);
+                        safe_send(chatId, "✅ Авторизация завершена. /courses");
+                    } else if (cr.http == 401 || cr.http == 404) {
+                        store_->clear(chatId);
+                        safe_send(chatId, "⏳ Авторизация истекла. Запусти снова: /login github|yandex|code");
+                    }
+                });
+            } while (cursor != "0" && !halted);
+            pending.set(static_cast<double>(seen.size()));
+            sweep.set(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
         }
-    }).detach();
+    });
 }
 
 void TelegramModuleBot::start_notification_thread() {
     int interval = std::stoi(getenv_or("TG_NOTIFICATION_INTERVAL_SEC", "30"));
     if (interval < 5) interval = 5;
 
-    std::thread([this, interval]() {
-        while (true) {
-            std::this_thread::sleep_for(std::chrono::seconds(interval));
-            for (auto chatId : store_->auth_chats()) {
-                Session s = store_->load(chatId);
-                if (s.status != SessionStatus::AUTH || s.access_token.empty()) continue;
-
-                auto r = main_.get("/notification", s.access_token);
-                if (r.status_code == 401 && refresh_if_needed(s)) {
-                    store_->save(chatId, s);
-                    r = main_.get("/notification", s.access_token);
+    background_.emplace_back([this, interval, page = sweep_page_size(), stop = stop_.get_token()]() {
+        auto& reg = MetricsRegistry::instance();
+        Gauge& authed = reg.gauge("tg_authed_chats", "Chats with an authenticated session");
+        Gauge& sweep = reg.gauge("tg_notification_sweep_seconds", "Duration of the last notification sweep");
+        Counter& skipped = sweeps_skipped("notification");
+        const std::chrono::milliseconds every = std::chrono::seconds(interval);
+        auto wait = jittered(every, 0.0, 1.0);
+        while (sleep_unless_stopped(stop, wait)) {
+            wait = jittered(every, 0.9, 1.1);
+            if (main_.breaker().rejecting()) {
+                skipped.inc();
+                continue;
+            }
+            const auto started = std::chrono::steady_clock::now();
+            std::unordered_set<std::int64_t> seen;
+            std::string cursor = "0";
+            std::atomic<bool> halted{false};
+            do {
+                auto chats = store_->scan_chats(SessionStore::ChatSet::AUTH, &cursor, page);
+                std::erase_if(chats, [&](std::int64_t chatId) { return !seen.insert(chatId).second || !cluster_.owns(chatId); });
+                // The page read only picks candidates; each chat's session is
+                // reloaded on its own chain right before it is used.
+                const auto snapshots = store_->load_many(chats);
+                std::vector<std::int64_t> candidates;
+                for (std::size_t i = 0; i < snapshots.size(); ++i) {
+                    if (snapshots[i].status == SessionStatus::AUTH && !snapshots[i].access_token.empty()) {
+                        candidates.push_back(chats[i]);
+                    }
                 }
-                if (r.status_code != 200) continue;
-
-                try {
-                    auto notes = json::parse(r.text);
-                    if (!notes.is_array() || notes.empty()) continue;
-
-                    int sent = 0;
-                    for (auto& n : notes) {
-                        std::string msg = n.value("message", "");
-                        if (msg.empty()) continue;
-                        safe_send(chatId, "🔔 " + msg);
-                        sent++;
+                sweep_page(candidates, [&](std::int64_t chatId) {
+                    if (halted) return;
+                    if (stop.stop_requested()) {
+                        halted = true;
+                        return;
                     }
+                    if (main_.breaker().rejecting()) {
+                        if (!halted.exchange(true)) skipped.inc();
+                        return;
+                    }
+                    Session s = store_->load(chatId);
+                    if (s.status != SessionStatus::AUTH || s.access_token.empty()) return;
+
+                    auto r = requests_.get(chatId, s, "/notification");
+                    if (r.status_code != 200) return;
+
+                    try {
+                        auto notes = json::parse(r.text);
+                        if (!notes.is_array() || notes.empty()) return;
+
+                        // Only clear the backend copy once every note is durably queued;
+                        // otherwise the next sweep fetches them again.
+                        int queued = 0;
+                        bool all_queued = true;
+                        for (auto& n : notes) {
+                            std::string msg = n.value("message", "");
+                            if (msg.empty()) continue;
+                            if (!outbox_.enqueue(chatId, "🔔 " + msg)) {
+                                all_queued = false;
+                                break;
+                            }
+                            queued++;
+                        }
 
-                    if (sent > 0) {
-                        auto d = main_.del("/notification", s.access_token);
-                        if (d.status_code == 401 && refresh_if_needed(s)) {
-                            store_->save(chatId, s);
-                            (void)main_.del("/notification", s.access_token);
+                        if (queued > 0 && all_queued) {
+                            (void)requests_.del(chatId, s, "/notification");
                         }
+                    } catch (...) {
                     }
-                } catch (...) {
+                });
+            } while (cursor != "0" && !halted);
+            authed.set(static_cast<double>(seen.size()));
+            sweep.set(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+        }
+    });
+}
+
+void TelegramModuleBot::start_outbox_thread() {
+    const auto poll = std::chrono::milliseconds(std::max(10, std::stoi(getenv_or("TG_OUTBOX_POLL_MS", "500"))));
+    const auto min_idle = std::chrono::milliseconds(std::max(1000, std::stoi(getenv_or("TG_OUTBOX_RECLAIM_MS", "60000"))));
+    const auto batch = static_cast<std::size_t>(std::max(1, std::stoi(getenv_or("TG_OUTBOX_BATCH", "32"))));
+
+    background_.emplace_back([this, poll, min_idle, batch, stop = stop_.get_token()]() {
+        auto& reg = MetricsRegistry::instance();
+        Counter& sent = reg.counter("tg_outbox_sent_total", "Queued messages delivered and acked");
+        Counter& dropped = reg.counter("tg_outbox_dropped_total", "Queued messages acked without delivery (refused or malformed)");
+        Counter& failed = reg.counter("tg_outbox_send_failures_total", "Queued messages left pending after a failed send");
+        bool ready = false;
+        auto last_reclaim = std::chrono::steady_clock::time_point{};
+        // Once stopping, keep sending what is already queued until it runs out
+        // or the drain deadline passes; the rest stays pending for another sender.
+        std::optional<std::chrono::steady_clock::time_point> drain_until;
+        while (true) {
+            const auto now = std::chrono::steady_clock::now();
+            if (stop.stop_requested()) {
+                // Set by request_stop() before the token fires.
+                if (!drain_until) drain_until = drain_deadline_;
+                if (!ready || now >= *drain_until) return;
+            }
+            if (!ready && !(ready = outbox_.ensure_group())) {
+                sleep_unless_stopped(stop, poll);
+                continue;
+            }
+            // Own failures and entries of dead senders come back here once idle long enough.
+            std::vector<OutboxStore::Message> msgs;
+            if (!drain_until && now - last_reclaim >= min_idle / 4) {
+                msgs = outbox_.reclaim(min_idle, batch);
+                if (msgs.empty()) last_reclaim = now;
+            }
+            if (msgs.empty()) msgs = outbox_.read(batch);
+            if (msgs.empty()) {
+                if (drain_until) return;
+                sleep_unless_stopped(stop, poll);
+                continue;
+            }
+            for (const auto& m : msgs) {
+                if (m.chat_id == 0) {
+                    outbox_.ack(m.id);
+                    dropped.inc();
+                    continue;
+                }
+                bool undeliverable = false;
+                if (safe_send(m.chat_id, m.text, nullptr, &undeliverable) != 0) {
+                    outbox_.ack(m.id);
+                    sent.inc();
+                } else if (undeliverable) {
+                    outbox_.ack(m.id);
+                    dropped.inc();
+                } else {
+                    failed.inc();
                 }
             }
         }
-    }).detach();
+    });
+}
+
+void TelegramModuleBot::start_answer_flush_thread() {
+    const auto flush_sec = std::chrono::seconds(std::max(1, std::stoi(getenv_or("TG_ANSWER_FLUSH_SEC", "15"))));
+
+    background_.emplace_back([this, flush_sec, page = sweep_page_size(), stop = stop_.get_token()]() {
+        Counter& skipped = sweeps_skipped("answers");
+        const std::chrono::milliseconds every = flush_sec;
+        auto wait = jittered(every, 0.0, 1.0);
+        while (sleep_unless_stopped(stop, wait)) {
+            wait = jittered(every, 0.9, 1.1);
+            if (main_.breaker().rejecting()) {
+                skipped.inc();
+                continue;
+            }
+            // Picks up short batches and lists left behind by a crashed replica.
+            std::string cursor = "0";
+            do {
+                for (const auto& a : answer_log_.scan(&cursor, page)) {
+                    if (!cluster_.owns(a.chat_id)) continue;
+                    // Through the chat's chain, so it never overlaps the chat's own taps.
+                    dispatcher_.submit(a.chat_id, [this, a]() {
+                        Session s = store_->load(a.chat_id);
+                        if (s.status != SessionStatus::AUTH || s.access_token.empty()) {
+                            // Logged out: nothing can deliver these any more.
+                            answer_log_.discard(a.chat_id, a.attempt_id);
+                            return;
+                        }
+                        (void)flush_answers(a.chat_id, s, a.attempt_id);
+                    });
+                }
+            } while (cursor != "0" && !stop.stop_requested());
+        }
+    });
 }
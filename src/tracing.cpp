@@ -0,0 +1,182 @@
+#include "tracing.h"
+
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+
+struct SpanRecord {
+    const char* name;
+    std::string detail;
+    std::uint64_t id;
+    std::uint64_t parent;
+    std::int64_t start_ns;
+    std::int64_t end_ns;
+};
+
+struct ActiveTrace {
+    std::uint64_t trace_hi{0};
+    std::uint64_t trace_lo{0};
+    std::int64_t chat_id{0};
+    std::vector<SpanRecord> spans;
+    std::vector<std::size_t> stack;
+};
+
+namespace {
+
+thread_local ActiveTrace* t_active = nullptr;
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+std::uint64_t rand64() {
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return rng();
+}
+
+std::size_t open_span(ActiveTrace& t, const char* name, std::string_view detail) {
+    std::uint64_t parent = t.stack.empty() ? 0 : t.spans[t.stack.back()].id;
+    t.spans.push_back(SpanRecord{name, std::string(detail), rand64() | 1, parent, now_ns(), 0});
+    t.stack.push_back(t.spans.size() - 1);
+    return t.spans.size() - 1;
+}
+
+void close_span(ActiveTrace& t, std::size_t idx) {
+    t.spans[idx].end_ns = now_ns();
+    if (!t.stack.empty() && t.stack.back() == idx) t.stack.pop_back();
+}
+
+void append_hex(std::string& out, std::uint64_t v) {
+    static const char* k = "0123456789abcdef";
+    for (int shift = 60; shift >= 0; shift -= 4) out.push_back(k[(v >> shift) & 0xf]);
+}
+
+void append_escaped(std::string& out, std::string_view s) {
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += ' ';
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+}
+
+std::string render(const ActiveTrace& t) {
+    std::string out;
+    out.reserve(t.spans.size() * 200);
+    for (std::size_t i = 0; i < t.spans.size(); ++i) {
+        const auto& s = t.spans[i];
+        out += "{\"trace_id\":\"";
+        append_hex(out, t.trace_hi);
+        append_hex(out, t.trace_lo);
+        out += "\",\"span_id\":\"";
+        append_hex(out, s.id);
+        out += "\",\"parent_span_id\":\"";
+        if (s.parent != 0) append_hex(out, s.parent);
+        out += "\",\"name\":\"";
+        append_escaped(out, s.name);
+        out += "\",\"start_time_unix_nano\":" + std::to_string(s.start_ns);
+        out += ",\"end_time_unix_nano\":" + std::to_string(s.end_ns);
+        out += ",\"attributes\":{";
+        if (i == 0) {
+            out += "\"chat_id\":" + std::to_string(t.chat_id);
+            if (!s.detail.empty()) out += ",";
+        }
+        if (!s.detail.empty()) {
+            out += "\"detail\":\"";
+            append_escaped(out, s.detail);
+            out += "\"";
+        }
+        out += "}}\n";
+    }
+    return out;
+}
+
+} // namespace
+
+Tracer& Tracer::instance() {
+    static Tracer t;
+    return t;
+}
+
+bool Tracer::configure(const std::string& path, double sample_rate) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+    sample_rate_ = sample_rate < 0.0 ? 0.0 : (sample_rate > 1.0 ? 1.0 : sample_rate);
+    if (path.empty()) return true;
+    file_ = std::fopen(path.c_str(), "a");
+    return file_ != nullptr;
+}
+
+bool Tracer::should_sample() const {
+    if (!file_ || sample_rate_ <= 0.0) return false;
+    if (sample_rate_ >= 1.0) return true;
+    return static_cast<double>(rand64() >> 11) * 0x1.0p-53 < sample_rate_;
+}
+
+void Tracer::write(const std::string& lines) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!file_) return;
+    std::fwrite(lines.data(), 1, lines.size(), file_);
+    std::fflush(file_);
+}
+
+TraceScope::TraceScope(const char* name, std::int64_t chat_id) {
+    if (t_active) {
+        nested_ = true;
+        span_ = open_span(*t_active, name, {});
+        return;
+    }
+    if (!Tracer::instance().should_sample()) return;
+    trace_ = std::make_unique<ActiveTrace>();
+    trace_->trace_hi = rand64();
+    trace_->trace_lo = rand64();
+    trace_->chat_id = chat_id;
+    trace_->spans.reserve(16);
+    span_ = open_span(*trace_, name, {});
+    t_active = trace_.get();
+}
+
+TraceScope::~TraceScope() {
+    if (nested_) {
+        if (t_active) close_span(*t_active, span_);
+        return;
+    }
+    if (!trace_) return;
+    close_span(*trace_, span_);
+    t_active = nullptr;
+    Tracer::instance().write(render(*trace_));
+}
+
+ActiveTrace* detach_trace() {
+    return std::exchange(t_active, nullptr);
+}
+
+AdoptTrace::AdoptTrace(ActiveTrace* trace) : prev_(std::exchange(t_active, trace)) {}
+
+// The coroutine may have finished (its TraceScope cleared t_active) or detached
+// again before suspending; either way the thread goes back to what it had.
+AdoptTrace::~AdoptTrace() {
+    t_active = prev_;
+}
+
+Span::Span(const char* name, std::string_view detail) {
+    if (!t_active) return;
+    idx_ = open_span(*t_active, name, detail);
+    active_ = true;
+}
+
+Span::~Span() {
+    if (active_ && t_active) close_span(*t_active, idx_);
+}
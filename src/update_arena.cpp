@@ -0,0 +1,118 @@
+#include "update_arena.h"
+
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "util.h"
+
+namespace {
+
+thread_local UpdateArena* t_arena = nullptr;
+
+std::size_t block_size() {
+    static const std::size_t size =
+        static_cast<std::size_t>(std::max(1024, std::stoi(getenv_or("TG_ARENA_BYTES", "16384"))));
+    return size;
+}
+
+// Arena blocks are recycled instead of freed; at most this many are kept idle.
+constexpr std::size_t kMaxIdleBlocks = 64;
+
+std::mutex g_blocks_mtx;
+std::vector<std::unique_ptr<std::byte[]>> g_blocks;
+
+std::unique_ptr<std::byte[]> take_block() {
+    {
+        std::lock_guard<std::mutex> lk(g_blocks_mtx);
+        if (!g_blocks.empty()) {
+            auto b = std::move(g_blocks.back());
+            g_blocks.pop_back();
+            return b;
+        }
+    }
+    return std::make_unique<std::byte[]>(block_size());
+}
+
+void give_block(std::unique_ptr<std::byte[]> b) {
+    std::lock_guard<std::mutex> lk(g_blocks_mtx);
+    if (g_blocks.size() < kMaxIdleBlocks) g_blocks.push_back(std::move(b));
+}
+
+} // namespace
+
+UpdateArena::UpdateArena() {
+    if (t_arena) {
+        // A handler running inside another update's scope shares its arena.
+        nested_ = true;
+        return;
+    }
+    block_.data = take_block();
+    block_.size = block_size();
+    mono_.emplace(block_.data.get(), block_.size, &overflow_);
+    t_arena = this;
+}
+
+UpdateArena::~UpdateArena() {
+    if (nested_) return;
+    static Counter& arenas = MetricsRegistry::instance().counter("tg_update_arenas_total", "Per-update scratch arenas opened");
+    static Counter& bytes =
+        MetricsRegistry::instance().counter("tg_update_arena_bytes_total", "Bytes handed out by per-update scratch arenas");
+    static Counter& overflows = MetricsRegistry::instance().counter(
+        "tg_update_arena_overflows_total", "Heap blocks taken because an update outgrew its scratch arena");
+    // Possibly on another thread than the one that opened it, if the handler
+    // finished after an IoPool hop.
+    if (t_arena == this) t_arena = nullptr;
+    mono_.reset();
+    give_block(std::move(block_.data));
+    arenas.inc();
+    bytes.inc(used_);
+    if (overflow_.calls > 0) overflows.inc(overflow_.calls);
+}
+
+void* UpdateArena::do_allocate(std::size_t bytes, std::size_t align) {
+    if (nested_) return scratch()->allocate(bytes, align);
+    used_ += bytes;
+    return mono_->allocate(bytes, align);
+}
+
+void UpdateArena::do_deallocate(void* p, std::size_t bytes, std::size_t align) {
+    if (nested_) {
+        scratch()->deallocate(p, bytes, align);
+        return;
+    }
+    mono_->deallocate(p, bytes, align);
+}
+
+void* UpdateArena::Overflow::do_allocate(std::size_t bytes, std::size_t align) {
+    ++calls;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+}
+
+void UpdateArena::Overflow::do_deallocate(void* p, std::size_t bytes, std::size_t align) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+}
+
+std::pmr::memory_resource* scratch() {
+    return t_arena ? static_cast<std::pmr::memory_resource*>(t_arena) : std::pmr::new_delete_resource();
+}
+
+UpdateArena* detach_arena() {
+    return std::exchange(t_arena, nullptr);
+}
+
+AdoptArena::AdoptArena(UpdateArena* arena) : prev_(std::exchange(t_arena, arena)) {}
+
+AdoptArena::~AdoptArena() {
+    t_arena = prev_;
+}
+
+void append_int(std::pmr::string& out, long long v) {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+    (void)ec;
+    out.append(buf, end);
+}
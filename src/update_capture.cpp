@@ -0,0 +1,99 @@
+#include "update_capture.h"
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+json message_json(const TgBot::Message::Ptr& m) {
+    json j = {{"message_id", m->messageId}};
+    if (m->chat) j["chat"] = {{"id", m->chat->id}};
+    if (!m->text.empty()) j["text"] = m->text;
+    return j;
+}
+
+// Never throws: bytes that are not UTF-8 become U+FFFD.
+std::string dump(const json& j) {
+    return j.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+TgBot::Message::Ptr message_from(const json& j) {
+    auto m = std::make_shared<TgBot::Message>();
+    m->messageId = j.value("message_id", 0);
+    m->chat = std::make_shared<TgBot::Chat>();
+    auto chat = j.find("chat");
+    if (chat != j.end() && chat->is_object()) m->chat->id = chat->value("id", std::int64_t{0});
+    m->text = j.value("text", "");
+    return m;
+}
+
+} // namespace
+
+UpdateCapture& UpdateCapture::instance() {
+    static UpdateCapture c;
+    return c;
+}
+
+bool UpdateCapture::configure(const std::string& path) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+    if (path.empty()) return true;
+    file_ = std::fopen(path.c_str(), "a");
+    started_ = std::chrono::steady_clock::now();
+    return file_ != nullptr;
+}
+
+void UpdateCapture::message(const TgBot::Message::Ptr& m) {
+    if (!file_ || !m) return;
+    write("message", dump(message_json(m)));
+}
+
+void UpdateCapture::callback(const TgBot::CallbackQuery::Ptr& q) {
+    if (!file_ || !q) return;
+    json j = {{"id", q->id}, {"data", q->data}};
+    if (q->message) {
+        // The tapped message is the bot's own; only where it is matters.
+        json m = message_json(q->message);
+        m.erase("text");
+        j["message"] = std::move(m);
+    }
+    write("callback_query", dump(j));
+}
+
+void UpdateCapture::write(const std::string& kind, const std::string& body) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!file_) return;
+    const auto at =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_).count();
+    const std::string line = "{\"at_ms\":" + std::to_string(at) + ",\"update_id\":" + std::to_string(next_id_++) +
+                             ",\"" + kind + "\":" + body + "}\n";
+    std::fwrite(line.data(), 1, line.size(), file_);
+    std::fflush(file_);
+}
+
+TgBot::Update::Ptr UpdateCapture::parse(const std::string& line, std::int64_t* at_ms) {
+    try {
+        const json j = json::parse(line);
+        auto u = std::make_shared<TgBot::Update>();
+        u->updateId = j.value("update_id", 0);
+        if (at_ms) *at_ms = j.value("at_ms", std::int64_t{0});
+        if (auto m = j.find("message"); m != j.end() && m->is_object()) {
+            u->message = message_from(*m);
+            return u;
+        }
+        if (auto q = j.find("callback_query"); q != j.end() && q->is_object()) {
+            u->callbackQuery = std::make_shared<TgBot::CallbackQuery>();
+            u->callbackQuery->id = q->value("id", "");
+            u->callbackQuery->data = q->value("data", "");
+            auto qm = q->find("message");
+            u->callbackQuery->message = message_from(qm != q->end() && qm->is_object() ? *qm : json::object());
+            return u;
+        }
+    } catch (...) {
+    }
+    return nullptr;
+}
@@ -1,9 +1,58 @@
 #include "util.h"
 
+#include <charconv>
+#include <condition_variable>
 #include <cstdlib>
-#include <cctype>
+#include <cstring>
+#include <mutex>
 #include <random>
-#include <sstream>
+#include <system_error>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+inline bool is_space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+// Each mask_* returns a bitmask with bit k set when byte p[k] matches.
+#if defined(__AVX2__)
+constexpr std::size_t kLane = 32;
+
+inline unsigned mask_eq(const char* p, char c) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+}
+
+inline unsigned mask_space(const char* p) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    // '\t'..'\r' <=> (c - 9) <= 4 as unsigned bytes.
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(4)), x);
+    return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(sp, ctl)));
+}
+#elif defined(__SSE2__)
+constexpr std::size_t kLane = 16;
+
+inline unsigned mask_eq(const char* p, char c) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+}
+
+inline unsigned mask_space(const char* p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(4)), x);
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(sp, ctl)));
+}
+#endif
+
+} // namespace
 
 std::string getenv_or(const char* key, const std::string& def) {
     const char* v = std::getenv(key);
@@ -20,37 +69,155 @@ std::string random_token(std::size_t len) {
     return out;
 }
 
-std::string trim(const std::string& s) {
-    std::size_t start = 0;
-    while (start < s.size() && std::isspace(static_cast<unsigned char>(s[start]))) start++;
-    std::size_t end = s.size();
-    while (end > start && std::isspace(static_cast<unsigned char>(s[end - 1]))) end--;
-    return s.substr(start, end - start);
+bool sleep_unless_stopped(std::stop_token stop, std::chrono::milliseconds d) {
+    std::mutex mtx;
+    std::condition_variable_any cv;
+    std::unique_lock<std::mutex> lk(mtx);
+    cv.wait_for(lk, stop, d, [] { return false; });
+    return !stop.stop_requested();
 }
 
+std::string trim(const std::string& s) { return std::string(trim_view(s)); }
+
 bool starts_with(const std::string& s, const std::string& prefix) {
     return s.rfind(prefix, 0) == 0;
 }
 
 std::vector<std::string> split_ws(const std::string& s) {
-    std::istringstream iss(s);
     std::vector<std::string> out;
-    std::string w;
-    while (iss >> w) out.push_back(w);
+    WordSplitter sp(s);
+    std::string_view w;
+    while (sp.next(w)) out.emplace_back(w);
     return out;
 }
 
 std::vector<std::string> split_by(const std::string& s, char delim) {
     std::vector<std::string> out;
-    std::string cur;
-    for (char c : s) {
-        if (c == delim) {
-            out.push_back(cur);
-            cur.clear();
-        } else {
-            cur.push_back(c);
+    FieldSplitter sp(s, delim);
+    std::string_view f;
+    while (sp.next(f)) out.emplace_back(f);
+    return out;
+}
+
+std::vector<std::string> chunk_message(const std::string& msg, std::size_t max) {
+    if (msg.size() <= max) return {msg};
+
+    std::vector<std::string> out;
+    std::string chunk;
+    chunk.reserve(max);
+    std::size_t pos = 0;
+    while (pos < msg.size()) {
+        auto nl = find_byte(msg, '\n', pos);
+        if (nl == std::string_view::npos) nl = msg.size();
+        const std::string_view line(msg.data() + pos, nl - pos);
+        if (!chunk.empty() && chunk.size() + line.size() + 1 > max) {
+            out.push_back(std::move(chunk));
+            chunk.clear();
+            chunk.reserve(max);
         }
+        chunk.append(line);
+        chunk.push_back('\n');
+        pos = nl + 1;
     }
-    out.push_back(cur);
+    if (!chunk.empty()) out.push_back(std::move(chunk));
     return out;
 }
+
+std::size_t find_byte(std::string_view s, char c, std::size_t from) {
+    std::size_t i = from;
+    if (i >= s.size()) return std::string_view::npos;
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (; i + kLane <= s.size(); i += kLane) {
+        unsigned m = mask_eq(s.data() + i, c);
+        if (m) return i + static_cast<std::size_t>(__builtin_ctz(m));
+    }
+#endif
+    const void* hit = std::memchr(s.data() + i, c, s.size() - i);
+    if (!hit) return std::string_view::npos;
+    return static_cast<std::size_t>(static_cast<const char*>(hit) - s.data());
+}
+
+std::size_t find_space(std::string_view s, std::size_t from) {
+    std::size_t i = from;
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (; i + kLane <= s.size(); i += kLane) {
+        unsigned m = mask_space(s.data() + i);
+        if (m) return i + static_cast<std::size_t>(__builtin_ctz(m));
+    }
+#endif
+    for (; i < s.size(); ++i) {
+        if (is_space(static_cast<unsigned char>(s[i]))) return i;
+    }
+    return std::string_view::npos;
+}
+
+std::string_view trim_view(std::string_view s) {
+    std::size_t start = 0;
+    while (start < s.size() && is_space(static_cast<unsigned char>(s[start]))) start++;
+    std::size_t end = s.size();
+    while (end > start && is_space(static_cast<unsigned char>(s[end - 1]))) end--;
+    return s.substr(start, end - start);
+}
+
+std::string_view command_payload(std::string_view text) {
+    auto pos = find_byte(text, ' ');
+    if (pos == std::string_view::npos) return {};
+    return trim_view(text.substr(pos + 1));
+}
+
+bool parse_int(std::string_view s, int* out) {
+    // std::stoi took "+5"; from_chars does not.
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') s.remove_prefix(1);
+    if (s.empty()) return false;
+    int v = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc{} || ptr != s.data() + s.size()) return false;
+    *out = v;
+    return true;
+}
+
+bool parse_int(std::string_view s, long long* out) {
+    // std::stoi took "+5"; from_chars does not.
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') s.remove_prefix(1);
+    if (s.empty()) return false;
+    long long v = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc{} || ptr != s.data() + s.size()) return false;
+    *out = v;
+    return true;
+}
+
+bool parse_bool_flag(std::string_view s, bool* out) {
+    if (s == "1" || s == "true" || s == "yes") {
+        *out = true;
+        return true;
+    }
+    if (s == "0" || s == "false" || s == "no") {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+bool FieldSplitter::next(std::string_view& field) {
+    if (done_) return false;
+    auto p = find_byte(s_, delim_, pos_);
+    if (p == std::string_view::npos) {
+        field = s_.substr(pos_);
+        done_ = true;
+        return true;
+    }
+    field = s_.substr(pos_, p - pos_);
+    pos_ = p + 1;
+    return true;
+}
+
+bool WordSplitter::next(std::string_view& word) {
+    while (pos_ < s_.size() && is_space(static_cast<unsigned char>(s_[pos_]))) pos_++;
+    if (pos_ >= s_.size()) return false;
+    auto e = find_space(s_, pos_);
+    if (e == std::string_view::npos) e = s_.size();
+    word = s_.substr(pos_, e - pos_);
+    pos_ = e;
+    return true;
+}